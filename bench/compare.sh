@@ -0,0 +1,30 @@
+#!/bin/sh
+#
+# Compares two outputs of bench/run.sh, one line per value that is in
+# both: bench, key, old, new and the change in percent
+#
+# Usage
+#   bench/compare.sh OLD NEW
+
+if [ $# -ne 2 ]; then
+	echo "Usage: bench/compare.sh OLD NEW"
+	exit 1
+fi
+
+awk '
+	FNR == 1 { file++ }
+	/^bench=/ {
+		name = substr($1, 7)
+		for (i = 2; i <= NF; i++) {
+			split($i, kv, "=")
+			if (file == 1) {
+				old[name " " kv[1]] = kv[2]
+			}
+			else if ((name " " kv[1]) in old) {
+				before = old[name " " kv[1]]
+				change = before != 0 ? sprintf("%+.1f%%", (kv[2] - before) * 100 / before) : "-"
+				printf "%-24s %-20s %12s %12s %8s\n", name, kv[1], before, kv[2], change
+			}
+		}
+	}
+' "$1" "$2"
@@ -0,0 +1,333 @@
+/**
+ * Command flood load generator for rf433-daemon
+ *
+ * Parallel clients send switch commands as fast as they can, each on its
+ * own connection like a runaway script, and count how the daemon answers:
+ * accepted, busy or failed. With -r a client waits the retry-after of a
+ * busy reply before its next command, like a well behaved client.
+ * Afterwards the admission counters of the daemon are printed. With -m
+ * all results are "bench=NAME key=value ..." lines for bench/run.sh,
+ * the daemon's on-air time and timing error included.
+ *
+ * With -b the run starts by queueing a batch of bulk commands for other
+ * plugs over one "pipeline bulk" connection, the queue wait per lane then
+ * shows how long interactive commands wait while the batch drains. Pace
+ * the interactive clients with -i and disable the rate limit of the
+ * daemon for this.
+ *
+ * This switches plugs for real, point it at a daemon on a test system or
+ * at group codes nobody uses.
+ *
+ * Usage
+ *   flood [-j CLIENTS] [-d SECONDS] [-p PLUGS] [-g GROUP] [-r] [-i MS] [-b COMMANDS] [-m] [-t HOST:PORT | -s PATH]
+ *
+ * Example
+ *   ./rf433-daemon -s /tmp/rf433.sock --rate=2:20 &
+ *   ./bench/flood -j 8 -d 10 -s /tmp/rf433.sock
+ *   ./rf433-daemon -s /tmp/rf433.sock --rate=0 --airtime-budget=60000 &
+ *   ./bench/flood -b 100 -j 1 -i 1000 -d 30 -s /tmp/rf433.sock
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+struct Client {
+	int index;
+	long accepted;
+	long busy;
+	long failed;
+	long retryWait;	// ms waited on busy replies
+	long* latencies;	// ns of the accepted commands
+	long maxLatencies;
+};
+
+static const char* tcpTarget = NULL;
+static const char* unixTarget = NULL;
+static const char* group = "11111";
+static int plugs = 5;
+static bool honorRetry = false;
+static long interval = 0;	// us between the commands of a client
+static long deadline;
+static bool machine = false;
+
+static long nowNs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static int cmpLong(const void* a, const void* b) {
+	long x = *(const long*) a;
+	long y = *(const long*) b;
+	return (x > y) - (x < y);
+}
+
+static int connectDaemon() {
+	int fd;
+	if (unixTarget != NULL) {
+		struct sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strncpy(addr.sun_path, unixTarget, sizeof(addr.sun_path) - 1);
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd >= 0 && connect(fd, (struct sockaddr*) &addr, sizeof(addr)) == 0) {
+			return fd;
+		}
+	}
+	else {
+		char host[64];
+		strncpy(host, tcpTarget, sizeof(host) - 1);
+		host[sizeof(host) - 1] = '\0';
+		char* colon = strrchr(host, ':');
+		int port = 11337;
+		if (colon != NULL) {
+			*colon = '\0';
+			port = atoi(colon + 1);
+		}
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(port);
+		inet_pton(AF_INET, host, &addr.sin_addr);
+		fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (fd >= 0 && connect(fd, (struct sockaddr*) &addr, sizeof(addr)) == 0) {
+			return fd;
+		}
+	}
+	if (fd >= 0) {
+		close(fd);
+	}
+	return -1;
+}
+
+/**
+ * one command, returns the reply length, 0 on failure
+ */
+static int request(const char* command, char* reply, int size) {
+	int fd = connectDaemon();
+	if (fd < 0) {
+		return 0;
+	}
+	int len = 0;
+	if (write(fd, command, strlen(command)) > 0) {
+		int n;
+		while (len < size - 1 && (n = read(fd, reply + len, size - 1 - len)) > 0) {
+			len += n;
+		}
+	}
+	reply[len] = '\0';
+	close(fd);
+	return len;
+}
+
+static void* flood(void* arg) {
+	Client* c = (Client*) arg;
+	char command[16];
+	char reply[32];
+	for (long i = c->index; nowNs() < deadline; i++) {
+		// cycle through the plugs A..E and on/off
+		int plug = i % plugs;
+		snprintf(command, sizeof(command), "1%s%02d%d", group, 16 >> (plug % 5), (int) (i / plugs) % 2);
+		long start = nowNs();
+		if (request(command, reply, sizeof(reply)) == 0) {
+			c->failed++;
+			continue;
+		}
+		if (reply[0] == 'B') {
+			c->busy++;
+			if (honorRetry) {
+				long ms = atol(reply + 1);
+				c->retryWait += ms;
+				usleep(ms * 1000);
+			}
+			continue;
+		}
+		if (c->accepted < c->maxLatencies) {
+			c->latencies[c->accepted] = nowNs() - start;
+		}
+		c->accepted++;
+		if (interval > 0) {
+			usleep(interval);
+		}
+	}
+	return NULL;
+}
+
+/**
+ * queue COMMANDS bulk commands for the plugs of all other groups, returns
+ * the number accepted
+ */
+static int queueBulk(int commands) {
+	int fd = connectDaemon();
+	if (fd < 0) {
+		return 0;
+	}
+	static char out[65536];
+	int len = sprintf(out, "pipeline bulk\n");
+	for (int i = 0, g = 0; i < commands && len < (int) sizeof(out) - 16; g++) {
+		char bin[6];
+		for (int b = 0; b < 5; b++) {
+			bin[b] = '0' + ((g >> (4 - b)) & 1);
+		}
+		bin[5] = '\0';
+		if (strcmp(bin, group) == 0) {
+			continue;
+		}
+		for (int unit = 16; unit > 0 && i < commands; unit >>= 1, i++) {
+			len += sprintf(out + len, "1%s%02d%d\n", bin, unit, (g / 32) % 2);
+		}
+	}
+	if (write(fd, out, len) != len) {
+		close(fd);
+		return 0;
+	}
+	int accepted = 0;
+	int lines = 0;
+	char reply[4096];
+	int n;
+	while (lines < commands && (n = read(fd, reply, sizeof(reply))) > 0) {
+		for (int i = 0; i < n; i++) {
+			if (i == 0 || reply[i - 1] == '\n') {
+				accepted += reply[i] != 'E';
+			}
+			lines += reply[i] == '\n';
+		}
+	}
+	close(fd);
+	return accepted;
+}
+
+int main(int argc, char* argv[]) {
+	int jobs = 8;
+	int seconds = 10;
+	int bulk = 0;
+
+	int c;
+	while ((c = getopt(argc, argv, "j:d:p:g:ri:b:mt:s:h")) != -1) {
+		switch (c) {
+			case 'j':
+				jobs = atoi(optarg);
+				break;
+			case 'd':
+				seconds = atoi(optarg);
+				break;
+			case 'p':
+				plugs = atoi(optarg);
+				break;
+			case 'g':
+				group = optarg;
+				break;
+			case 'r':
+				honorRetry = true;
+				break;
+			case 'i':
+				interval = atol(optarg) * 1000;
+				break;
+			case 'b':
+				bulk = atoi(optarg);
+				break;
+			case 'm':
+				machine = true;
+				break;
+			case 't':
+				tcpTarget = optarg;
+				break;
+			case 's':
+				unixTarget = optarg;
+				break;
+			default:
+				printf("Usage: flood [-j CLIENTS] [-d SECONDS] [-p PLUGS] [-g GROUP] [-r] [-i MS] [-b COMMANDS] [-m] [-t HOST:PORT | -s PATH]\n");
+				return c == 'h' ? 0 : 1;
+		}
+	}
+	if (tcpTarget == NULL && unixTarget == NULL) {
+		tcpTarget = "127.0.0.1:11337";
+	}
+	if (jobs < 1) jobs = 1;
+	if (plugs < 1) plugs = 1;
+
+	if (bulk > 0) {
+		printf(machine ? "bench=flood_bulk queued=%d commands=%d\n" : "bulk queued=%d of %d\n", queueBulk(bulk), bulk);
+	}
+
+	Client* clients = (Client*) calloc(jobs, sizeof(Client));
+	pthread_t* threads = (pthread_t*) malloc(sizeof(pthread_t) * jobs);
+	long start = nowNs();
+	deadline = start + seconds * 1000000000L;
+	for (int j = 0; j < jobs; j++) {
+		clients[j].index = j;
+		clients[j].maxLatencies = 1000000;
+		clients[j].latencies = (long*) malloc(sizeof(long) * clients[j].maxLatencies);
+		pthread_create(&threads[j], NULL, flood, &clients[j]);
+	}
+	long accepted = 0, busy = 0, failed = 0, retryWait = 0, kept = 0;
+	for (int j = 0; j < jobs; j++) {
+		pthread_join(threads[j], NULL);
+		accepted += clients[j].accepted;
+		busy += clients[j].busy;
+		failed += clients[j].failed;
+		retryWait += clients[j].retryWait;
+		kept += clients[j].accepted < clients[j].maxLatencies ? clients[j].accepted : clients[j].maxLatencies;
+	}
+	double elapsed = (nowNs() - start) / 1e9;
+
+	long* latencies = (long*) malloc(sizeof(long) * (kept > 0 ? kept : 1));
+	long n = 0;
+	for (int j = 0; j < jobs; j++) {
+		long count = clients[j].accepted < clients[j].maxLatencies ? clients[j].accepted : clients[j].maxLatencies;
+		memcpy(latencies + n, clients[j].latencies, sizeof(long) * count);
+		n += count;
+	}
+	qsort(latencies, n, sizeof(long), cmpLong);
+	if (machine) {
+		printf("bench=flood clients=%d seconds=%.1f accepted=%ld accepted_per_s=%.1f busy=%ld busy_per_s=%.1f failed=%ld retry_wait_ms=%ld",
+			jobs, elapsed, accepted, accepted / elapsed, busy, busy / elapsed, failed, retryWait);
+		if (n > 0) {
+			printf(" p50_us=%.1f p99_us=%.1f max_us=%.1f",
+				latencies[n / 2] / 1000.0, latencies[(n * 99) / 100] / 1000.0, latencies[n - 1] / 1000.0);
+		}
+		printf("\n");
+	}
+	else {
+		printf("clients=%d seconds=%.1f accepted=%ld (%.1f/s) busy=%ld (%.1f/s) failed=%ld retry_wait=%ldms\n",
+			jobs, elapsed, accepted, accepted / elapsed, busy, busy / elapsed, failed, retryWait);
+		if (n > 0) {
+			printf("accepted reply p50=%.1fus p99=%.1fus max=%.1fus\n",
+				latencies[n / 2] / 1000.0, latencies[(n * 99) / 100] / 1000.0, latencies[n - 1] / 1000.0);
+		}
+	}
+
+	// what the daemon saw
+	static char stats[65536];
+	if (request("stats", stats, sizeof(stats)) > 0) {
+		const char* keys[] = { "busy_", "superseded", "queue_", "on_air" };
+		for (char* line = strtok(stats, "\n"); line != NULL; line = strtok(NULL, "\n")) {
+			for (unsigned i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+				if (strncmp(line, keys[i], strlen(keys[i])) != 0) {
+					continue;
+				}
+				char* value = strchr(line, ' ');
+				if (!machine || value == NULL) {
+					printf("daemon %s\n", line);
+				}
+				else if (strchr(value, '=') != NULL) {
+					// "on_air_us count=10 ..." as bench=daemon_on_air_us count=10 ...
+					printf("bench=daemon_%.*s%s\n", (int) (value - line), line, value);
+				}
+				else {
+					printf("bench=daemon_%.*s value=%s\n", (int) (value - line), line, value + 1);
+				}
+			}
+		}
+	}
+	return failed > 0 ? 1 : 0;
+}
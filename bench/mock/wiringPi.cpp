@@ -0,0 +1,109 @@
+/**
+ * mock GPIO backend, see wiringPi.h
+ */
+
+#include <time.h>
+#include <sched.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "wiringPi.h"
+
+static pthread_mutex_t locks[4] = {
+	PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER,
+	PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER
+};
+static int levels[64];
+static struct timespec epoch;
+
+static unsigned long long elapsedUs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec - epoch.tv_sec) * 1000000ULL + ts.tv_nsec / 1000 - epoch.tv_nsec / 1000;
+}
+
+int wiringPiSetup(void) {
+	clock_gettime(CLOCK_MONOTONIC, &epoch);
+	return 0;
+}
+
+int wiringPiSetupSys(void) {
+	return wiringPiSetup();
+}
+
+int wiringPiSetupGpio(void) {
+	return wiringPiSetup();
+}
+
+int wiringPiISR(int pin, int mode, void (*function)(void)) {
+	return 0;
+}
+
+void pinMode(int pin, int mode) {
+}
+
+void digitalWrite(int pin, int value) {
+	levels[pin & 63] = value;
+}
+
+int digitalRead(int pin) {
+	return levels[pin & 63];
+}
+
+/**
+ * like wiringPi: real time round robin scheduling when allowed, an
+ * unprivileged benchmark just runs without
+ */
+int piHiPri(const int pri) {
+	struct sched_param sched;
+	memset(&sched, 0, sizeof(sched));
+	sched.sched_priority = sched_get_priority_max(SCHED_RR) < pri ? sched_get_priority_max(SCHED_RR) : pri;
+	return sched_setscheduler(0, SCHED_RR, &sched);
+}
+
+int piThreadCreate(void* (*fn)(void*)) {
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, fn, NULL) != 0) {
+		return -1;
+	}
+	pthread_detach(thread);
+	return 0;
+}
+
+void piLock(int key) {
+	pthread_mutex_lock(&locks[key & 3]);
+}
+
+void piUnlock(int key) {
+	pthread_mutex_unlock(&locks[key & 3]);
+}
+
+void delay(unsigned int howLong) {
+	struct timespec sleeper = { (time_t) (howLong / 1000), (long) (howLong % 1000) * 1000000 };
+	nanosleep(&sleeper, NULL);
+}
+
+/**
+ * like wiringPi: below 100us busy waiting, the kernel would oversleep
+ */
+void delayMicroseconds(unsigned int howLong) {
+	if (howLong == 0) {
+		return;
+	}
+	if (howLong < 100) {
+		unsigned long long end = elapsedUs() + howLong;
+		while (elapsedUs() < end) {
+		}
+		return;
+	}
+	struct timespec sleeper = { (time_t) (howLong / 1000000), (long) (howLong % 1000000) * 1000 };
+	nanosleep(&sleeper, NULL);
+}
+
+unsigned int millis(void) {
+	return (unsigned int) (elapsedUs() / 1000);
+}
+
+unsigned int micros(void) {
+	return (unsigned int) elapsedUs();
+}
@@ -0,0 +1,49 @@
+/**
+ * mock GPIO backend, the part of the wiringPi API rc-switch and the daemon
+ * use
+ *
+ * Pins go nowhere, but the timing calls behave like wiringPi: short
+ * delays busy wait, long ones sleep. The daemon built against it
+ * (make bench/rf433-daemon-mock) runs on any Linux box and its on-air
+ * times and timing errors are what the scheduler of that box allows.
+ */
+
+#define INPUT 0
+#define OUTPUT 1
+
+#define LOW 0
+#define HIGH 1
+
+#define INT_EDGE_SETUP 0
+#define INT_EDGE_FALLING 1
+#define INT_EDGE_RISING 2
+#define INT_EDGE_BOTH 3
+
+#define PI_THREAD(X) void* X(void* dummy)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int wiringPiSetup(void);
+int wiringPiSetupSys(void);
+int wiringPiSetupGpio(void);
+int wiringPiISR(int pin, int mode, void (*function)(void));
+
+void pinMode(int pin, int mode);
+void digitalWrite(int pin, int value);
+int digitalRead(int pin);
+
+int piHiPri(const int pri);
+int piThreadCreate(void* (*fn)(void*));
+void piLock(int key);
+void piUnlock(int key);
+
+void delay(unsigned int howLong);
+void delayMicroseconds(unsigned int howLong);
+unsigned int millis(void);
+unsigned int micros(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,283 @@
+/**
+ * Replays a traffic capture of rf433-daemon (--capture) for load tests
+ *
+ * Every recorded command is sent again at its recorded time, divided by
+ * the speed, one connection per command like the original clients. The
+ * commands of one client keep their order, different clients are spread
+ * over parallel senders. Reply latencies are reported separately for
+ * status queries and switch commands, plus how far the senders fell
+ * behind the schedule, which is 0 unless the daemon or this box can't
+ * keep up.
+ *
+ * All commands come from this one process, so run the test daemon
+ * without rate limit. It switches plugs, point it at the daemon on the
+ * mock GPIO backend (make bench/rf433-daemon-mock).
+ *
+ * Usage
+ *   replay [-x SPEED] [-j SENDERS] [-m] [-t HOST:PORT | -s PATH] FILE
+ *
+ * Example
+ *   ./rf433-daemon -C /var/tmp/morning.cap ...
+ *   ./bench/rf433-daemon-mock -p 0 -s /tmp/rf433.sock --rate=0 --airtime-budget=600000 &
+ *   ./bench/replay -x 10 -s /tmp/rf433.sock /var/tmp/morning.cap
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "../rf433-capture.h"
+#include "../rf433-protocol.h"
+
+#define KIND_STATUS 0
+#define KIND_SWITCH 1
+#define KINDS 2
+
+struct Command {
+	long at;	// ns after the start of the replay
+	int lane;
+	int kind;
+	char command[CAPTURE_MAX_COMMAND + 1];
+	int sender;
+	// results
+	long latency;	// ns, -1 when it failed
+	long late;	// ns behind the schedule
+	bool busy;
+};
+
+struct Sender {
+	int index;
+	Command* commands;
+	int count;
+};
+
+static const char* tcpTarget = NULL;
+static const char* unixTarget = NULL;
+static const char* kindNames[KINDS] = { "status", "switch" };
+static long start;
+
+static long nowNs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static int cmpLong(const void* a, const void* b) {
+	long x = *(const long*) a;
+	long y = *(const long*) b;
+	return (x > y) - (x < y);
+}
+
+static int connectDaemon() {
+	int fd;
+	if (unixTarget != NULL) {
+		struct sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strncpy(addr.sun_path, unixTarget, sizeof(addr.sun_path) - 1);
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd >= 0 && connect(fd, (struct sockaddr*) &addr, sizeof(addr)) == 0) {
+			return fd;
+		}
+	}
+	else {
+		char host[64];
+		strncpy(host, tcpTarget, sizeof(host) - 1);
+		host[sizeof(host) - 1] = '\0';
+		char* colon = strrchr(host, ':');
+		int port = 11337;
+		if (colon != NULL) {
+			*colon = '\0';
+			port = atoi(colon + 1);
+		}
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(port);
+		inet_pton(AF_INET, host, &addr.sin_addr);
+		fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (fd >= 0 && connect(fd, (struct sockaddr*) &addr, sizeof(addr)) == 0) {
+			return fd;
+		}
+	}
+	if (fd >= 0) {
+		close(fd);
+	}
+	return -1;
+}
+
+static void replayCommand(Command* c) {
+	char request[CAPTURE_MAX_COMMAND + 8];
+	char reply[64];
+	int len = snprintf(request, sizeof(request), "%s%s\n", c->lane ? "bulk " : "", c->command);
+	long sent = nowNs();
+	c->late = sent - start - c->at;
+	c->latency = -1;
+	int fd = connectDaemon();
+	if (fd < 0) {
+		return;
+	}
+	if (write(fd, request, len) == len) {
+		int n = read(fd, reply, sizeof(reply) - 1);
+		if (n > 0) {
+			c->latency = nowNs() - sent;
+			c->busy = reply[0] == 'B';
+		}
+	}
+	close(fd);
+}
+
+static void* sender(void* arg) {
+	Sender* s = (Sender*) arg;
+	for (int i = 0; i < s->count; i++) {
+		Command* c = &s->commands[i];
+		if (c->sender != s->index) {
+			continue;
+		}
+		long wait = start + c->at - nowNs();
+		if (wait > 0) {
+			struct timespec ts = { wait / 1000000000L, wait % 1000000000L };
+			nanosleep(&ts, NULL);
+		}
+		replayCommand(c);
+	}
+	return NULL;
+}
+
+static void report(const char* name, long* samples, long n, bool machine) {
+	if (n == 0) {
+		return;
+	}
+	qsort(samples, n, sizeof(long), cmpLong);
+	printf(machine ? "bench=replay_%s n=%ld p50_us=%.1f p90_us=%.1f p99_us=%.1f max_us=%.1f\n"
+		: "%-7s n=%ld p50=%.1fus p90=%.1fus p99=%.1fus max=%.1fus\n",
+		name, n, samples[n / 2] / 1000.0, samples[(n * 9) / 10] / 1000.0,
+		samples[(n * 99) / 100] / 1000.0, samples[n - 1] / 1000.0);
+}
+
+int main(int argc, char* argv[]) {
+	double speed = 1;
+	int jobs = 16;
+	bool machine = false;
+
+	int c;
+	while ((c = getopt(argc, argv, "x:j:mt:s:h")) != -1) {
+		switch (c) {
+			case 'x':
+				speed = atof(optarg);
+				break;
+			case 'j':
+				jobs = atoi(optarg);
+				break;
+			case 'm':
+				machine = true;
+				break;
+			case 't':
+				tcpTarget = optarg;
+				break;
+			case 's':
+				unixTarget = optarg;
+				break;
+			default:
+				printf("Usage: replay [-x SPEED] [-j SENDERS] [-m] [-t HOST:PORT | -s PATH] FILE\n");
+				return c == 'h' ? 0 : 1;
+		}
+	}
+	if (optind != argc - 1) {
+		printf("Usage: replay [-x SPEED] [-j SENDERS] [-m] [-t HOST:PORT | -s PATH] FILE\n");
+		return 1;
+	}
+	if (tcpTarget == NULL && unixTarget == NULL) {
+		tcpTarget = "127.0.0.1:11337";
+	}
+	if (speed <= 0) speed = 1;
+	if (jobs < 1) jobs = 1;
+
+	/*
+	* load the capture, the schedule is computed up front
+	*/
+	FILE* file = fopen(argv[optind], "rb");
+	CaptureHeader header;
+	if (file == NULL || !captureReadHeader(file, &header)) {
+		printf("not a capture: %s\n", argv[optind]);
+		return 1;
+	}
+	protocolInit();
+	int size = 1024;
+	int count = 0;
+	Command* commands = (Command*) malloc(sizeof(Command) * size);
+	CaptureRecord record;
+	memset(&record, 0, sizeof(record));
+	while (captureRead(file, &record)) {
+		if (count == size) {
+			size *= 2;
+			commands = (Command*) realloc(commands, sizeof(Command) * size);
+		}
+		Command* command = &commands[count++];
+		command->at = (long) (record.at * 1000 / speed);
+		command->lane = record.lane;
+		strcpy(command->command, record.command);
+		// same client, same sender
+		command->sender = (record.client * 2654435761UL >> 16) % jobs;
+		command->busy = false;
+		const Protocol* protocol = protocolFor(record.command[0]);
+		CommandContext ctx;
+		memset(&ctx, 0, sizeof(ctx));
+		command->kind = protocol != NULL && (int) strlen(record.command) >= protocol->minLength
+			&& protocol->parse(record.command, &ctx) == RESULT_OK && ctx.action == 2 ? KIND_STATUS : KIND_SWITCH;
+	}
+	fclose(file);
+	if (count == 0) {
+		printf("empty capture\n");
+		return 1;
+	}
+
+	Sender* senders = (Sender*) calloc(jobs, sizeof(Sender));
+	pthread_t* threads = (pthread_t*) malloc(sizeof(pthread_t) * jobs);
+	start = nowNs();
+	for (int j = 0; j < jobs; j++) {
+		senders[j].index = j;
+		senders[j].commands = commands;
+		senders[j].count = count;
+		pthread_create(&threads[j], NULL, sender, &senders[j]);
+	}
+	for (int j = 0; j < jobs; j++) {
+		pthread_join(threads[j], NULL);
+	}
+	double elapsed = (nowNs() - start) / 1e9;
+
+	long* samples[KINDS];
+	long n[KINDS] = { 0, 0 };
+	long* late = (long*) malloc(sizeof(long) * count);
+	long failed = 0;
+	long busy = 0;
+	for (int k = 0; k < KINDS; k++) {
+		samples[k] = (long*) malloc(sizeof(long) * count);
+	}
+	for (int i = 0; i < count; i++) {
+		late[i] = commands[i].late > 0 ? commands[i].late : 0;
+		if (commands[i].latency < 0) {
+			failed++;
+			continue;
+		}
+		busy += commands[i].busy;
+		samples[commands[i].kind][n[commands[i].kind]++] = commands[i].latency;
+	}
+	double recorded = commands[count - 1].at * speed / 1e9;
+	printf(machine ? "bench=replay commands=%d recorded_s=%.1f speed=%.1f seconds=%.1f rate_per_s=%.1f busy=%ld failed=%ld\n"
+		: "commands=%d recorded=%.1fs speed=%.1fx seconds=%.1f rate=%.1f/s busy=%ld failed=%ld\n",
+		count, recorded, speed, elapsed, count / elapsed, busy, failed);
+	for (int k = 0; k < KINDS; k++) {
+		report(kindNames[k], samples[k], n[k], machine);
+	}
+	report("late", late, count, machine);
+	return failed > 0 ? 1 : 0;
+}
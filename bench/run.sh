@@ -0,0 +1,39 @@
+#!/bin/sh
+#
+# Benchmark suite, "make bench" builds and runs it
+#
+# micro  parse, encode and render of every registered plug system
+# macro  the daemon on the mock GPIO backend: status queries from CLIENTS
+#        parallel clients, then CLIENTS clients flooding it with switch
+#        commands for SECONDS, with the daemon's queue wait, on-air time
+#        and on-air timing error
+#
+# Every result is one line "bench=NAME key=value ...", the unit is part
+# of the key. Keep the output of two commits and compare them with
+# bench/compare.sh.
+#
+# Usage
+#   bench/run.sh [CLIENTS] [SECONDS]
+#
+# Example
+#   make bench && cp bench/results.txt /tmp/before.txt
+#   git checkout topic && make bench && bench/compare.sh /tmp/before.txt bench/results.txt
+
+CLIENTS=${1:-8}
+DURATION=${2:-10}
+BENCH=$(dirname "$0")
+DIR=$(mktemp -d)
+SOCKET=$DIR/rf433.sock
+
+"$BENCH/protocols" || exit 1
+
+# no rate limit and room for a whole flood, the queue is what is measured
+"$BENCH/rf433-daemon-mock" -p 0 -s "$SOCKET" -v error --rate=0 --airtime-budget=600000 &
+DAEMON=$!
+trap 'kill $DAEMON 2>/dev/null; rm -rf "$DIR"' EXIT
+while [ ! -S "$SOCKET" ]; do
+	sleep 0.1
+done
+
+"$BENCH/status-latency" -m -n 10000 -j "$CLIENTS" -s "$SOCKET" || exit 1
+"$BENCH/flood" -m -j "$CLIENTS" -d "$DURATION" -s "$SOCKET" || exit 1
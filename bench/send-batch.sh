@@ -0,0 +1,45 @@
+#!/bin/sh
+#
+# Batch benchmark for send
+#
+# Switches COUNT sockets off, once with one send process per command and
+# once with all commands piped into a single "send -f -". The difference is
+# the per process setup (exec, wiringPiSetup, piHiPri, enableTransmit).
+# Needs the transmitter, so run it on the Pi with sockets you may switch.
+#
+# Usage
+#   bench/send-batch.sh [COUNT] [SYSTEMCODE] [SEND OPTIONS...]
+#
+# Example
+#   sudo bench/send-batch.sh 100 00001 -r 3
+
+COUNT=${1:-100}
+SYSTEM=${2:-00001}
+[ $# -gt 0 ] && shift
+[ $# -gt 0 ] && shift
+SEND=${SEND:-$(dirname "$0")/../send}
+
+commands() {
+	i=0
+	while [ $i -lt "$COUNT" ]; do
+		echo "$SYSTEM $((i % 5 + 1)) 0"
+		i=$((i + 1))
+	done
+}
+
+now() {
+	date +%s%N
+}
+
+start=$(now)
+commands | while read -r system unit command; do
+	"$SEND" -s "$@" "$system" "$unit" "$command" || exit 1
+done
+single=$(( ($(now) - start) / 1000000 ))
+
+start=$(now)
+commands | "$SEND" -s "$@" -f - || exit 1
+batch=$(( ($(now) - start) / 1000000 ))
+
+echo "single n=$COUNT total=${single}ms per_command=$((single / COUNT))ms"
+echo "batch  n=$COUNT total=${batch}ms per_command=$((batch / COUNT))ms"
@@ -0,0 +1,215 @@
+/**
+ * Status query latency benchmark for rf433-daemon
+ *
+ * Measures connect + status query + reply for both transports of the
+ * daemon, TCP and the unix domain socket. Status queries never touch the
+ * transmitter, so this runs against a live daemon without switching plugs.
+ * With -j the queries are spread over parallel clients and the
+ * throughput shows how the daemon's workers scale with the cores.
+ * With -m the results are printed as "bench=status_tcp key=value ..."
+ * lines for bench/run.sh.
+ *
+ * Usage
+ *   status-latency [-n COUNT] [-j CLIENTS] [-t HOST:PORT] [-s PATH] [-c COMMAND] [-m]
+ *
+ * Example
+ *   ./rf433-daemon -s /tmp/rf433.sock &
+ *   ./bench/status-latency -n 10000 -t 127.0.0.1:11337 -s /tmp/rf433.sock
+ *   for w in 1 2 4; do ./rf433-daemon -w $w -p 11400 & sleep 1
+ *     ./bench/status-latency -n 100000 -j 8 -t 127.0.0.1:11400; kill $!; done
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+static bool machine = false;
+
+static long nowNs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static int cmpLong(const void* a, const void* b) {
+	long x = *(const long*) a;
+	long y = *(const long*) b;
+	return (x > y) - (x < y);
+}
+
+static int connectTcp(const char* hostPort) {
+	char host[64];
+	strncpy(host, hostPort, sizeof(host) - 1);
+	host[sizeof(host) - 1] = '\0';
+	char* colon = strrchr(host, ':');
+	int port = 11337;
+	if (colon != NULL) {
+		*colon = '\0';
+		port = atoi(colon + 1);
+	}
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	inet_pton(AF_INET, host, &addr.sin_addr);
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+		if (fd >= 0) close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int connectUnix(const char* path) {
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+		if (fd >= 0) close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+struct Client {
+	const char* name;
+	const char* target;
+	bool unixSocket;
+	const char* command;
+	long* samples;
+	int count;
+	int done;
+};
+
+/**
+ * count status queries, one connection each like the web interface
+ */
+static void* client(void* arg) {
+	Client* c = (Client*) arg;
+	char reply[16];
+	for (int i = 0; i < c->count; i++) {
+		long start = nowNs();
+		int fd = c->unixSocket ? connectUnix(c->target) : connectTcp(c->target);
+		if (fd < 0) {
+			perror(c->name);
+			break;
+		}
+		if (write(fd, c->command, strlen(c->command)) < 0 || read(fd, reply, sizeof(reply)) <= 0) {
+			perror(c->name);
+			close(fd);
+			break;
+		}
+		close(fd);
+		c->samples[c->done++] = nowNs() - start;
+	}
+	return NULL;
+}
+
+static int run(const char* name, const char* target, bool unixSocket, const char* command, int count, int jobs) {
+	long* samples = (long*) malloc(sizeof(long) * count);
+	Client* clients = (Client*) calloc(jobs, sizeof(Client));
+	pthread_t* threads = (pthread_t*) malloc(sizeof(pthread_t) * jobs);
+	long wall = nowNs();
+	for (int j = 0; j < jobs; j++) {
+		clients[j].name = name;
+		clients[j].target = target;
+		clients[j].unixSocket = unixSocket;
+		clients[j].command = command;
+		clients[j].samples = samples + (long) count * j / jobs;
+		clients[j].count = (long) count * (j + 1) / jobs - (long) count * j / jobs;
+		pthread_create(&threads[j], NULL, client, &clients[j]);
+	}
+	int done = 0;
+	for (int j = 0; j < jobs; j++) {
+		pthread_join(threads[j], NULL);
+		// compact the samples of all clients
+		memmove(samples + done, clients[j].samples, sizeof(long) * clients[j].done);
+		done += clients[j].done;
+	}
+	wall = nowNs() - wall;
+	free(clients);
+	free(threads);
+	if (done == 0) {
+		free(samples);
+		return 1;
+	}
+	qsort(samples, done, sizeof(long), cmpLong);
+	long sum = 0;
+	for (int i = 0; i < done; i++) {
+		sum += samples[i];
+	}
+	printf(machine ? "bench=status_%s n=%d j=%d min_us=%.1f p50_us=%.1f p99_us=%.1f max_us=%.1f mean_us=%.1f rate_per_s=%.0f\n"
+		: "%-5s n=%d j=%d min=%.1fus p50=%.1fus p99=%.1fus max=%.1fus mean=%.1fus rate=%.0f/s\n",
+		name, done, jobs,
+		samples[0] / 1000.0,
+		samples[done / 2] / 1000.0,
+		samples[(done * 99) / 100] / 1000.0,
+		samples[done - 1] / 1000.0,
+		(double) sum / done / 1000.0,
+		done * 1e9 / wall);
+	free(samples);
+	return 0;
+}
+
+int main(int argc, char* argv[]) {
+	int count = 1000;
+	int jobs = 1;
+	const char* tcpTarget = NULL;
+	const char* unixTarget = NULL;
+	const char* command = "100001162";
+
+	int c;
+	while ((c = getopt(argc, argv, "n:j:t:s:c:mh")) != -1) {
+		switch (c) {
+			case 'n':
+				count = atoi(optarg);
+				break;
+			case 'j':
+				jobs = atoi(optarg);
+				break;
+			case 't':
+				tcpTarget = optarg;
+				break;
+			case 's':
+				unixTarget = optarg;
+				break;
+			case 'c':
+				command = optarg;
+				break;
+			case 'm':
+				machine = true;
+				break;
+			default:
+				printf("Usage: status-latency [-n COUNT] [-j CLIENTS] [-t HOST:PORT] [-s PATH] [-c COMMAND] [-m]\n");
+				return c == 'h' ? 0 : 1;
+		}
+	}
+	if (tcpTarget == NULL && unixTarget == NULL) {
+		tcpTarget = "127.0.0.1:11337";
+	}
+	if (count < 1) {
+		count = 1;
+	}
+	if (jobs < 1) {
+		jobs = 1;
+	}
+
+	int result = 0;
+	if (tcpTarget != NULL) {
+		result |= run("tcp", tcpTarget, false, command, count, jobs);
+	}
+	if (unixTarget != NULL) {
+		result |= run("unix", unixTarget, true, command, count, jobs);
+	}
+	return result;
+}
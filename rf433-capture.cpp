@@ -0,0 +1,127 @@
+/**
+ * traffic capture of the RCSwitch daemon
+ *
+ * With --capture every command a client sends is appended to a compact
+ * binary log (format in rf433-capture.h) together with the time and the
+ * client, so the load of a real day can be replayed against a test
+ * daemon (bench/replay). Workers append the records to a buffer under a
+ * short lock, the capture thread writes it out once a second, so the
+ * disk never stalls a request. When the buffer is full records are
+ * dropped and counted. Up to a second of traffic is lost if the daemon
+ * is killed.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "rf433-daemon.h"
+#include "rf433-capture.h"
+#include "rf433-stats.h"
+#include "rf433-log.h"
+
+static int captureFd = -1;
+static pthread_mutex_t captureLock = PTHREAD_MUTEX_INITIALIZER;
+// the write of the capture thread is serialized against captureFlush()
+static pthread_mutex_t writeLock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned char buffer[CAPTURE_BUFFER_SIZE];
+static int used = 0;
+static long last;	// monotonic us of the previous record
+static unsigned long dropped = 0;
+
+PI_THREAD(captureThread);
+
+static int putVarint(unsigned char* out, unsigned long long value) {
+	int n = 0;
+	while (value >= 0x80) {
+		out[n++] = (value & 0x7f) | 0x80;
+		value >>= 7;
+	}
+	out[n++] = value;
+	return n;
+}
+
+/**
+ * start capturing to PATH, an existing file is replaced
+ */
+bool captureOpen(const char* path) {
+	captureFd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0640);
+	if (captureFd < 0) {
+		return false;
+	}
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	CaptureHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CAPTURE_MAGIC, sizeof(header.magic));
+	header.version = CAPTURE_VERSION;
+	header.start = (unsigned long long) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+	last = statsNow();
+	if (write(captureFd, &header, sizeof(header)) != sizeof(header) || piThreadCreate(captureThread) != 0) {
+		close(captureFd);
+		captureFd = -1;
+		return false;
+	}
+	return true;
+}
+
+void captureCommand(const char* command, unsigned long client, int lane) {
+	if (captureFd < 0) {
+		return;
+	}
+	int len = strcspn(command, "\r\n");
+	if (len > CAPTURE_MAX_COMMAND) {
+		len = CAPTURE_MAX_COMMAND;
+	}
+	pthread_mutex_lock(&captureLock);
+	// two varints of at most 10 bytes, the length and the command
+	if (used + 21 + len > CAPTURE_BUFFER_SIZE) {
+		dropped++;
+		pthread_mutex_unlock(&captureLock);
+		return;
+	}
+	long now = statsNow();
+	used += putVarint(buffer + used, now > last ? now - last : 0);
+	used += putVarint(buffer + used, client);
+	buffer[used++] = lane << 7 | len;
+	memcpy(buffer + used, command, len);
+	used += len;
+	last = now > last ? now : last;
+	pthread_mutex_unlock(&captureLock);
+}
+
+/**
+ * write what is buffered, before exit and once a second
+ */
+void captureFlush() {
+	static unsigned char out[CAPTURE_BUFFER_SIZE];
+	if (captureFd < 0) {
+		return;
+	}
+	pthread_mutex_lock(&writeLock);
+	pthread_mutex_lock(&captureLock);
+	int len = used;
+	memcpy(out, buffer, len);
+	used = 0;
+	unsigned long lost = dropped;
+	dropped = 0;
+	pthread_mutex_unlock(&captureLock);
+	if (len > 0 && write(captureFd, out, len) != len) {
+		LOG_E("ERROR writing capture, %d bytes lost", len);
+	}
+	pthread_mutex_unlock(&writeLock);
+	if (lost > 0) {
+		LOG_W("capture buffer full, %lu commands not captured", lost);
+	}
+}
+
+PI_THREAD(captureThread) {
+	while (true) {
+		sleep(1);
+		captureFlush();
+	}
+	return 0;
+}
@@ -0,0 +1,88 @@
+/**
+ * traffic capture of the RCSwitch daemon
+ *
+ * A capture file is a CaptureHeader followed by one record per command
+ * a client sent:
+ *   varint  us since the previous record, since the start for the first
+ *   varint  client, IP address or uid of the unix socket peer
+ *   byte    lane << 7 | length of the command
+ *   bytes   the command without the line end
+ * Varints hold 7 bits per byte, the lowest first, with the high bit set
+ * on all bytes but the last. A status query takes about 16 bytes.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#define CAPTURE_MAGIC "RF433CAP"
+#define CAPTURE_VERSION 1
+#define CAPTURE_MAX_COMMAND 127
+// records are batched here and written once a second
+#define CAPTURE_BUFFER_SIZE 65536
+
+struct CaptureHeader {
+	char magic[8];
+	unsigned int version;
+	unsigned int reserved;
+	unsigned long long start;	// us since the epoch
+};
+
+struct CaptureRecord {
+	unsigned long long at;	// us since the start
+	unsigned long client;
+	int lane;
+	char command[CAPTURE_MAX_COMMAND + 1];
+};
+
+bool captureOpen(const char* path);
+void captureCommand(const char* command, unsigned long client, int lane);
+void captureFlush();
+
+inline bool captureVarint(FILE* file, unsigned long long* value) {
+	*value = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		int c = getc(file);
+		if (c == EOF) {
+			return false;
+		}
+		*value |= (unsigned long long) (c & 0x7f) << shift;
+		if ((c & 0x80) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * header of a capture file, false if it is none
+ */
+inline bool captureReadHeader(FILE* file, CaptureHeader* header) {
+	return fread(header, sizeof(CaptureHeader), 1, file) == 1
+		&& memcmp(header->magic, CAPTURE_MAGIC, sizeof(header->magic)) == 0
+		&& header->version == CAPTURE_VERSION;
+}
+
+/**
+ * next record, record->at accumulates from the previous one, so start
+ * with a zeroed record; false at the end of the file
+ */
+inline bool captureRead(FILE* file, CaptureRecord* record) {
+	unsigned long long delta;
+	unsigned long long client;
+	if (!captureVarint(file, &delta) || !captureVarint(file, &client)) {
+		return false;
+	}
+	int c = getc(file);
+	if (c == EOF) {
+		return false;
+	}
+	int len = c & CAPTURE_MAX_COMMAND;
+	if (fread(record->command, 1, len, file) != (size_t) len) {
+		return false;
+	}
+	record->command[len] = '\0';
+	record->at += delta;
+	record->client = client;
+	record->lane = c >> 7;
+	return true;
+}
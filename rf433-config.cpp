@@ -0,0 +1,543 @@
+/**
+ * device, profile and scene configuration of the RCSwitch daemon
+ *
+ * The config file (--config=PATH) has one entry per line, # starts a
+ * comment:
+ *
+ *   transmitter pin=0
+ *   profile NAME pulse=US [system=DIGIT]
+ *   device NAME KEY [profile=NAME] [circuit=NAME]
+ *   scene NAME [stagger=MS] DEVICE|KEY=STATE ...
+ *
+ * A profile with a system is the default of that system's plugs,
+ * otherwise the pulse lengths of rf433-protocol.cpp apply. KEY is the
+ * command prefix of a plug as in the replies, e.g. 10000116. Devices
+ * are switched by name with "on NAME", "off NAME" and "status NAME",
+ * their frames are encoded and rendered when the file is loaded.
+ *
+ * Devices that share a circuit name are one group of the stagger policy
+ * (rf433-tx.cpp): a scene with stagger=MS, or run with "scene NAME
+ * stagger=MS", switches the plugs of a group on at least MS apart. The
+ * circuit is named, not declared, up to TX_CIRCUITS - 1 of them.
+ *
+ * SIGHUP or the "reload" command loads the file again. The new tables
+ * only replace the old ones when the whole file is valid, commands in
+ * flight finish with the tables they started with (rf433-config.h).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <semaphore.h>
+#include <pthread.h>
+#include <atomic>
+
+#include "rf433-daemon.h"
+#include "rf433-config.h"
+#include "rf433-tx.h"
+#include "rf433-log.h"
+
+/**
+ * a reader's epoch while it is between configEnter() and configExit(),
+ * 0 outside, one cache line each
+ */
+struct ConfigReader {
+	std::atomic<unsigned long> epoch;
+	char padding[64 - sizeof(std::atomic<unsigned long>)];
+};
+
+static const char* configPath = NULL;
+static std::atomic<Config*> active(NULL);
+static std::atomic<unsigned long> epoch(1);
+static ConfigReader readers[CONFIG_READERS];
+static std::atomic<int> nReaders(0);
+static __thread int readerSlot = -1;
+static __thread int readerDepth = 0;
+
+static pthread_mutex_t reloadLock = PTHREAD_MUTEX_INITIALIZER;
+static sem_t reloadRequest;
+
+PI_THREAD(configThread);
+
+static void configFree(Config* config) {
+	if (config == NULL) {
+		return;
+	}
+	free(config->profiles);
+	free(config->devices);
+	free(config->scenes);
+	free(config->items);
+	free(config->pulse);
+	free(config->circuits);
+	free(config->circuit);
+	free(config->frames);
+	free(config->displacements);
+	free(config->slots);
+	delete config;
+}
+
+/**
+ * index of a circuit name, a new one is added, -1 when there are too many
+ */
+static int findCircuit(Config* config, const char* name) {
+	for (int i = 1; i < config->nCircuits; i++) {
+		if (strcmp(config->circuits[i], name) == 0) {
+			return i;
+		}
+	}
+	if (config->nCircuits == TX_CIRCUITS) {
+		return -1;
+	}
+	strcpy(config->circuits[config->nCircuits], name);
+	return config->nCircuits++;
+}
+
+static int findProfile(const Config* config, const char* name) {
+	for (int i = 0; i < config->nProfiles; i++) {
+		if (strcmp(config->profiles[i].name, name) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static int findDevice(const Config* config, const char* name) {
+	for (int i = 0; i < config->nDevices; i++) {
+		if (strcmp(config->devices[i].name, name) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/**
+ * 64 bit FNV-1a of the name, the high half picks the bucket, the low
+ * half mixed with the displacement the slot, one pass over the name
+ */
+static unsigned long long nameHash(const char* name) {
+	unsigned long long hash = 14695981039346656037ULL;
+	for (const unsigned char* p = (const unsigned char*) name; *p != '\0'; p++) {
+		hash = (hash ^ *p) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+static unsigned int nameSlot(unsigned long long hash, unsigned int displacement) {
+	unsigned int x = (unsigned int) hash ^ (displacement * 0x9e3779b9u);
+	x ^= x >> 16;
+	x *= 0x85ebca6bu;
+	return x ^ (x >> 13);
+}
+
+static int bucketSize(const void* a, const void* b, void* sizes) {
+	return ((int*) sizes)[*(const int*) b] - ((int*) sizes)[*(const int*) a];
+}
+
+/**
+ * hash and displace: the largest buckets first, each gets the first
+ * displacement that puts all its names into free slots
+ */
+static bool buildHash(Config* config) {
+	int n = config->nDevices;
+	config->nBuckets = n / CONFIG_HASH_LOAD + 1;
+	config->displacements = (unsigned int*) calloc(config->nBuckets, sizeof(unsigned int));
+	config->slots = (int*) malloc(sizeof(int) * (n > 0 ? n : 1));
+	int* bucketOf = (int*) malloc(sizeof(int) * (n > 0 ? n : 1));
+	int* sizes = (int*) calloc(config->nBuckets, sizeof(int));
+	int* order = (int*) malloc(sizeof(int) * config->nBuckets);
+	int* members = (int*) malloc(sizeof(int) * (n > 0 ? n : 1));
+	unsigned long long* hashes = (unsigned long long*) malloc(sizeof(unsigned long long) * (n > 0 ? n : 1));
+	for (int i = 0; i < n; i++) {
+		config->slots[i] = -1;
+		hashes[i] = nameHash(config->devices[i].name);
+		bucketOf[i] = (hashes[i] >> 32) % config->nBuckets;
+		sizes[bucketOf[i]]++;
+	}
+	for (int b = 0; b < config->nBuckets; b++) {
+		order[b] = b;
+	}
+	qsort_r(order, config->nBuckets, sizeof(int), bucketSize, sizes);
+
+	bool built = true;
+	for (int o = 0; o < config->nBuckets && built && sizes[order[o]] > 0; o++) {
+		int b = order[o];
+		int count = 0;
+		for (int i = 0; i < n; i++) {
+			if (bucketOf[i] == b) {
+				members[count++] = i;
+			}
+		}
+		built = false;
+		for (unsigned int d = 1; d < (1u << 20); d++) {
+			int placed = 0;
+			for (; placed < count; placed++) {
+				int slot = nameSlot(hashes[members[placed]], d) % n;
+				if (config->slots[slot] >= 0) {
+					break;
+				}
+				config->slots[slot] = members[placed];
+			}
+			if (placed == count) {
+				config->displacements[b] = d;
+				built = true;
+				break;
+			}
+			// undo the ones that fit
+			for (int i = 0; i < placed; i++) {
+				config->slots[nameSlot(hashes[members[i]], d) % n] = -1;
+			}
+		}
+	}
+	free(bucketOf);
+	free(sizes);
+	free(order);
+	free(members);
+	free(hashes);
+	return built;
+}
+
+/**
+ * value of "key=value" among the words, NULL if missing
+ */
+static const char* option(char** words, int n, const char* key) {
+	int len = strlen(key);
+	for (int i = 0; i < n; i++) {
+		if (strncmp(words[i], key, len) == 0 && words[i][len] == '=') {
+			return words[i] + len + 1;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * build the tables of the file, NULL with the reason in message
+ */
+static Config* configLoad(const char* path, char* message, int size) {
+	Config* config = new Config();
+	config->pulse = (unsigned short*) calloc(nPlugs, sizeof(unsigned short));
+	config->circuit = (unsigned char*) calloc(nPlugs, sizeof(unsigned char));
+	config->circuits = (char (*)[CONFIG_NAME_SIZE]) calloc(TX_CIRCUITS, CONFIG_NAME_SIZE);
+	config->nCircuits = 1;
+	if (path == NULL) {
+		return config;
+	}
+	FILE* file = fopen(path, "r");
+	if (file == NULL) {
+		snprintf(message, size, "can't open %s", path);
+		configFree(config);
+		return NULL;
+	}
+	int sizes[3] = { 8, 64, 8 };
+	int nItems = 0;
+	int itemSize = 64;
+	config->profiles = (ConfigProfile*) malloc(sizeof(ConfigProfile) * sizes[0]);
+	config->devices = (ConfigDevice*) malloc(sizeof(ConfigDevice) * sizes[1]);
+	config->scenes = (ConfigScene*) malloc(sizeof(ConfigScene) * sizes[2]);
+	config->items = (ConfigSceneItem*) malloc(sizeof(ConfigSceneItem) * itemSize);
+
+	char line[1024];
+	int number = 0;
+	const char* failed = NULL;
+	while (failed == NULL && fgets(line, sizeof(line), file) != NULL) {
+		number++;
+		char* hash = strchr(line, '#');
+		if (hash != NULL) {
+			*hash = '\0';
+		}
+		char* words[64];
+		int n = 0;
+		for (char* word = strtok(line, " \t\r\n"); word != NULL && n < 64; word = strtok(NULL, " \t\r\n")) {
+			words[n++] = word;
+		}
+		if (n == 0) {
+			continue;
+		}
+		if (n > 1 && strlen(words[1]) >= CONFIG_NAME_SIZE) {
+			failed = "name too long";
+		}
+		else if (strcmp(words[0], "transmitter") == 0) {
+			const char* pin = option(words, n, "pin");
+			if (pin != NULL) {
+				config->pin = atoi(pin);
+			}
+		}
+		else if (strcmp(words[0], "profile") == 0) {
+			const char* pulse = option(words, n, "pulse");
+			const char* system = option(words, n, "system");
+			if (n < 3 || pulse == NULL || atoi(pulse) <= 0 || atoi(pulse) > 0xffff) {
+				failed = "profile needs a name and pulse=US";
+			}
+			else if (findProfile(config, words[1]) >= 0) {
+				failed = "duplicate profile";
+			}
+			else if (system != NULL && protocolFor(system[0]) == NULL) {
+				failed = "unknown system";
+			}
+			else {
+				if (config->nProfiles == sizes[0]) {
+					sizes[0] *= 2;
+					config->profiles = (ConfigProfile*) realloc(config->profiles, sizeof(ConfigProfile) * sizes[0]);
+				}
+				ConfigProfile* profile = &config->profiles[config->nProfiles++];
+				strcpy(profile->name, words[1]);
+				profile->pulseLength = atoi(pulse);
+				profile->system = system != NULL ? system[0] - '0' : 0;
+			}
+		}
+		else if (strcmp(words[0], "device") == 0) {
+			const char* profile = option(words, n, "profile");
+			const char* circuit = option(words, n, "circuit");
+			int addr = n >= 3 ? protocolAddress(words[2]) : -1;
+			if (addr < 0) {
+				failed = "device needs a name and the key of a plug";
+			}
+			else if (findDevice(config, words[1]) >= 0) {
+				failed = "duplicate device";
+			}
+			else if (profile != NULL && findProfile(config, profile) < 0) {
+				failed = "unknown profile";
+			}
+			else if (circuit != NULL && (strlen(circuit) >= CONFIG_NAME_SIZE || findCircuit(config, circuit) < 0)) {
+				failed = "too many circuits";
+			}
+			else {
+				if (config->nDevices == sizes[1]) {
+					sizes[1] *= 2;
+					config->devices = (ConfigDevice*) realloc(config->devices, sizeof(ConfigDevice) * sizes[1]);
+				}
+				ConfigDevice* device = &config->devices[config->nDevices++];
+				strcpy(device->name, words[1]);
+				device->addr = addr;
+				device->system = words[2][0] - '0';
+				device->profile = profile != NULL ? findProfile(config, profile) : -1;
+				device->circuit = circuit != NULL ? findCircuit(config, circuit) : 0;
+				config->circuit[addr] = device->circuit;
+			}
+		}
+		else if (strcmp(words[0], "scene") == 0) {
+			if (n < 3) {
+				failed = "scene needs a name and items";
+			}
+			else if (configScene(config, words[1]) != NULL) {
+				failed = "duplicate scene";
+			}
+			else {
+				if (config->nScenes == sizes[2]) {
+					sizes[2] *= 2;
+					config->scenes = (ConfigScene*) realloc(config->scenes, sizeof(ConfigScene) * sizes[2]);
+				}
+				ConfigScene* scene = &config->scenes[config->nScenes++];
+				strcpy(scene->name, words[1]);
+				scene->first = nItems;
+				scene->count = 0;
+				scene->stagger = 0;
+				for (int i = 2; i < n && failed == NULL; i++) {
+					if (strncmp(words[i], "stagger=", 8) == 0) {
+						scene->stagger = atoi(words[i] + 8);
+						continue;
+					}
+					char* equals = strrchr(words[i], '=');
+					if (equals == NULL || (strcmp(equals, "=0") != 0 && strcmp(equals, "=1") != 0)) {
+						failed = "scene items are DEVICE=0|1 or KEY=0|1";
+						break;
+					}
+					*equals = '\0';
+					int device = findDevice(config, words[i]);
+					int addr = device >= 0 ? config->devices[device].addr : protocolAddress(words[i]);
+					if (addr < 0) {
+						failed = "unknown device in scene";
+						break;
+					}
+					if (scene->count == CONFIG_SCENE_ITEMS) {
+						failed = "too many items in scene";
+						break;
+					}
+					if (nItems == itemSize) {
+						itemSize *= 2;
+						config->items = (ConfigSceneItem*) realloc(config->items, sizeof(ConfigSceneItem) * itemSize);
+					}
+					config->items[nItems].addr = addr;
+					config->items[nItems].state = equals[1] - '0';
+					nItems++;
+					scene->count++;
+				}
+			}
+		}
+		else {
+			failed = "unknown entry";
+		}
+	}
+	fclose(file);
+	if (failed != NULL) {
+		snprintf(message, size, "%s line %d: %s", path, number, failed);
+		configFree(config);
+		return NULL;
+	}
+
+	// pulse length per plug: the device's profile, else the system's
+	for (int i = 0; i < config->nProfiles; i++) {
+		const Protocol* protocol = config->profiles[i].system > 0 ? protocolFor('0' + config->profiles[i].system) : NULL;
+		for (int offset = 0; protocol != NULL && offset < protocol->addrSize; offset++) {
+			config->pulse[protocol->base + offset] = config->profiles[i].pulseLength;
+		}
+	}
+	for (int i = 0; i < config->nDevices; i++) {
+		if (config->devices[i].profile >= 0) {
+			config->pulse[config->devices[i].addr] = config->profiles[config->devices[i].profile].pulseLength;
+		}
+	}
+	if (!buildHash(config)) {
+		snprintf(message, size, "%s: no perfect hash of the device names", path);
+		configFree(config);
+		return NULL;
+	}
+
+	// the frames of the devices, so a command by name skips parsing
+	config->frames = (TxFrame*) calloc(config->nDevices * 2, sizeof(TxFrame));
+	for (int i = 0; i < config->nDevices; i++) {
+		ConfigDevice* device = &config->devices[i];
+		char key[20];
+		int len = protocolKey(device->addr, key);
+		strcpy(key + len, "1");
+		const Protocol* protocol = protocolFor(key[0]);
+		CommandContext ctx;
+		memset(&ctx, 0, sizeof(ctx));
+		protocol->parse(key, &ctx);
+		int pulse = config->pulse[device->addr] != 0 ? config->pulse[device->addr] : protocol->pulseLength;
+		for (int on = 0; on < 2; on++) {
+			txBuild(&config->frames[i * 2 + on], protocol, &ctx, on, pulse);
+			txRender(&config->frames[i * 2 + on]);
+			config->frames[i * 2 + on].circuit = device->circuit;
+		}
+	}
+	snprintf(message, size, "profiles=%d devices=%d scenes=%d circuits=%d", config->nProfiles, config->nDevices, config->nScenes, config->nCircuits - 1);
+	return config;
+}
+
+/**
+ * wait until no reader can still see what was replaced
+ */
+static void synchronize() {
+	unsigned long now = epoch.fetch_add(1) + 1;
+	int n = nReaders.load();
+	for (int i = 0; i < n; i++) {
+		while (true) {
+			unsigned long seen = readers[i].epoch.load();
+			if (seen == 0 || seen >= now) {
+				break;
+			}
+			usleep(100);
+		}
+	}
+}
+
+static void onHangup(int) {
+	sem_post(&reloadRequest);
+}
+
+/**
+ * load the config of PATH, the built-in defaults without, false if it
+ * is invalid
+ */
+bool configInit(const char* path) {
+	configPath = path;
+	char message[256];
+	Config* config = configLoad(path, message, sizeof(message));
+	if (config == NULL) {
+		printf("%s\n", message);
+		return false;
+	}
+	config->version = 1;
+	active.store(config);
+	if (path != NULL) {
+		LOG_I("config: %s", message);
+		sem_init(&reloadRequest, 0, 0);
+		signal(SIGHUP, onHangup);
+		return piThreadCreate(configThread) == 0;
+	}
+	return true;
+}
+
+/**
+ * load the file again and swap it in, message tells the new version or
+ * why the old one stays
+ */
+bool configReload(char* message, int size) {
+	if (configPath == NULL) {
+		snprintf(message, size, "no config file");
+		return false;
+	}
+	pthread_mutex_lock(&reloadLock);
+	Config* config = configLoad(configPath, message, size);
+	if (config == NULL) {
+		pthread_mutex_unlock(&reloadLock);
+		LOG_W("config not reloaded: %s", message);
+		return false;
+	}
+	Config* old = active.load();
+	config->version = old->version + 1;
+	active.store(config);
+	synchronize();
+	configFree(old);
+	pthread_mutex_unlock(&reloadLock);
+	int len = strlen(message);
+	snprintf(message + len, size - len, " version=%lu", config->version);
+	LOG_I("config reloaded: %s", message);
+	return true;
+}
+
+/**
+ * the current tables, valid until configExit(), calls may nest
+ */
+const Config* configEnter() {
+	if (readerDepth++ == 0) {
+		if (readerSlot < 0) {
+			readerSlot = nReaders.fetch_add(1);
+			if (readerSlot >= CONFIG_READERS) {
+				error("ERROR too many config readers");
+			}
+		}
+		// published before the pointer is read, see synchronize()
+		readers[readerSlot].epoch.store(epoch.load());
+	}
+	return active.load();
+}
+
+void configExit() {
+	if (--readerDepth == 0) {
+		readers[readerSlot].epoch.store(0, std::memory_order_release);
+	}
+}
+
+const ConfigScene* configScene(const Config* config, const char* name) {
+	for (int i = 0; i < config->nScenes; i++) {
+		if (strcmp(config->scenes[i].name, name) == 0) {
+			return &config->scenes[i];
+		}
+	}
+	return NULL;
+}
+
+/**
+ * index of the device with the name, -1 if there is none
+ */
+int configDevice(const Config* config, const char* name) {
+	if (config->nDevices == 0) {
+		return -1;
+	}
+	unsigned long long hash = nameHash(name);
+	unsigned int d = config->displacements[(hash >> 32) % config->nBuckets];
+	int device = config->slots[nameSlot(hash, d) % config->nDevices];
+	return device >= 0 && strcmp(config->devices[device].name, name) == 0 ? device : -1;
+}
+
+PI_THREAD(configThread) {
+	char message[256];
+	while (true) {
+		sem_wait(&reloadRequest);
+		configReload(message, sizeof(message));
+	}
+	return 0;
+}
@@ -0,0 +1,83 @@
+/**
+ * device, profile and scene configuration of the RCSwitch daemon
+ *
+ * The tables of a config file (--config) are built in one Config that
+ * is never changed after it was published. A reload builds a new one off
+ * to the side and swaps the pointer, readers see either the old or the
+ * new tables, never a mix, and take no lock:
+ *
+ *   const Config* config = configEnter();
+ *   ... use config ...
+ *   configExit();
+ *
+ * The old Config is freed once every thread that was between
+ * configEnter() and configExit() has left (a read-copy-update grace
+ * period). Readers must not block in between.
+ *
+ * Device names are found through a minimal perfect hash built with the
+ * tables: the name picks a bucket, the bucket's displacement a slot of
+ * its own, one string compare tells whether it is the name or unknown.
+ */
+
+#define CONFIG_NAME_SIZE 32
+// threads that may read the config: workers, transmitter, schedules
+#define CONFIG_READERS 32
+// devices per bucket of the perfect hash, on average
+#define CONFIG_HASH_LOAD 4
+// plugs per scene, a scene is copied out of the config to run it
+#define CONFIG_SCENE_ITEMS 1024
+
+struct TxFrame;
+
+struct ConfigProfile {
+	char name[CONFIG_NAME_SIZE];
+	int pulseLength;	// us
+	int system;	// digit of the system it is the default of, 0 for none
+};
+
+struct ConfigDevice {
+	char name[CONFIG_NAME_SIZE];
+	int addr;	// state address
+	int system;	// digit
+	int profile;	// index, -1 for the default of the system
+	int circuit;	// index, 0 for none
+};
+
+struct ConfigSceneItem {
+	int addr;
+	int state;
+};
+
+struct ConfigScene {
+	char name[CONFIG_NAME_SIZE];
+	int first;	// index of the first item
+	int count;
+	int stagger;	// ms between on frames of one circuit, 0 for none
+};
+
+struct Config {
+	unsigned long version;	// 1 for the first one loaded
+	int pin;	// wiringPi pin of the transmitter
+	int nProfiles;
+	ConfigProfile* profiles;
+	int nDevices;
+	ConfigDevice* devices;
+	int nScenes;
+	ConfigScene* scenes;
+	ConfigSceneItem* items;
+	unsigned short* pulse;	// us per state address, 0 for the system's
+	int nCircuits;	// named ones, index 0 is every plug without one
+	char (*circuits)[CONFIG_NAME_SIZE];
+	unsigned char* circuit;	// per state address
+	TxFrame* frames;	// off and on of every device, rendered
+	int nBuckets;
+	unsigned int* displacements;	// per bucket
+	int* slots;	// device of each hash slot
+};
+
+bool configInit(const char* path);
+bool configReload(char* message, int size);
+const Config* configEnter();
+void configExit();
+const ConfigScene* configScene(const Config* config, const char* name);
+int configDevice(const Config* config, const char* name);
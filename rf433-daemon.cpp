@@ -36,470 +36,1248 @@
  *   Switch Zap plug 5 on group 11000 to on
  *     echo 300FFF051 | nc localhost 11337
  *
+ *   Switch a device of the config (--config) by name
+ *     echo on kitchen.lamp | nc localhost 11337
+ *     echo status kitchen.lamp | nc localhost 11337
+ *
+ * Options
+ *   -p, --port=PORT         TCP port to listen on (default 11337, 0 disables TCP)
+ *   -s, --socket=PATH       additionally listen on a unix domain socket
+ *   -b, --bulk-socket=PATH  unix socket whose commands queue in the bulk lane
+ *   -m, --socket-mode=MODE  permissions of the unix socket (octal, default 0660)
+ *   -H, --http=PORT         serve the HTTP/JSON interface on PORT
+ *   -M, --metrics           serve Prometheus metrics on /metrics of the HTTP port
+ *   -v, --log-level=LEVEL   error, warn, info or debug, default info
+ *   -r, --rate=RATE[:BURST] switch commands per second and client, default 2:20
+ *   -a, --airtime-budget=MS airtime the transmit queue may hold, default 10000
+ *   -D, --duty-cycle=PERCENT[:SECONDS]
+ *                           airtime per window before low priority frames
+ *                           wait, default 0 (never) over 600 seconds
+ *   -w, --workers=N         threads answering requests, default one per core
+ *   -x, --idle-exit=SECONDS exit after SECONDS without clients
+ *   -c, --config=PATH       devices, profiles and scenes, see
+ *                           rf433-config.cpp, reloaded on SIGHUP
+ *   -C, --capture=PATH      record every command with time and client to
+ *                           PATH, for bench/replay
+ *   -J, --journal=PATH[:KB] journal accepted and sent commands to PATH and
+ *                           rebuild the states from it at start, rotated
+ *                           at KB, default 1024
+ *   -T, --schedules=PATH    keep the recurring schedules in PATH
+ *   -S, --history=PATH      keep the state history of the plugs in PATH
+ *                           so it survives restarts
+ *
+ *   Listening sockets can be handed over by a supervisor instead, as
+ *   with systemd socket activation: LISTEN_FDS descriptors starting at 3,
+ *   LISTEN_PID set to the daemon's pid and LISTEN_FDNAMES naming them,
+ *   "http" serves HTTP, "bulk" the raw protocol in the bulk lane,
+ *   everything else the raw protocol. The TCP port
+ *   is then only opened if -p is given. wiringPi is set up on the first
+ *   transmission, so together with --idle-exit the daemon only runs while
+ *   it is used. rf433-launch is a minimal supervisor doing this:
+ *     ./rf433-launch -p 11337 -s /run/rf433.sock -- ./rf433-daemon -x 300
+ *
+ *   Local clients should prefer the unix socket, it skips the TCP stack
+ *     echo 100001162 | nc -U /run/rf433.sock
+ *
+ * Metrics
+ *   command counters and latency histograms
+ *     echo stats | nc localhost 11337
+ *
+ *   trace of the last requests: id, command, outcome and the time in us
+ *   from accept to parse, enqueue, transmit start and transmit end
+ *     echo traces | nc localhost 11337
+ *   prefix a command with "trace " to get its trace with the reply
+ *     echo trace 100001161 | nc localhost 11337
+ *     O id=17 cmd=100001161 addr=17 status=ok accept=0 parse=21 ...
+ *
+ *   seconds on and transitions of a plug, or of all, between two times
+ *   (seconds since the epoch or, negative, before now), default today
+ *     echo history 10000116 -3600 | nc localhost 11337
+ *     10000116 on=1200 transitions=2 state=0
+ *
+ *   recurring schedules, cron expressions with an optional random delay,
+ *   their switch commands go into the bulk lane
+ *     echo schedule add 30 6 \* \* mon-fri ~600 100001161 | nc localhost 11337
+ *     echo schedule list | nc localhost 11337
+ *     echo schedule del 1 | nc localhost 11337
+ *
+ *   run a scene of the config, or load the config again
+ *     echo scene evening | nc localhost 11337
+ *     echo scene evening stagger=800 | nc localhost 11337
+ *     echo reload | nc localhost 11337
+ *
+ *   pairing sweep: the on frame of every address of a range, sent
+ *   between the queued frames, see rf433-sweep.h
+ *     echo sweep start 1 | nc localhost 11337
+ *     echo sweep start 10000001-10000031 repeat=3 | nc localhost 11337
+ *     echo sweep | nc localhost 11337
+ *     sweep running elro on sent=12 of=32 last=10000012 next=10000013 elapsed_ms=1076 left_ms=1792
+ *   "sweep pause", "sweep resume" and "sweep stop" control it
+ *
+ *   all plug states as bitmaps, 64 plugs per 16 hex digits
+ *     echo bitmap | nc localhost 11337
+ *
+ *   change the log level at run time, replies with the active level
+ *     echo loglevel debug | nc localhost 11337
+ *
+ * Backpressure
+ *   a switch command over the client's rate or the airtime budget is not
+ *   queued, the reply is "B" and the ms after which a retry will pass
+ *     echo 100001161 | nc localhost 11337
+ *     B 1250
+ *
+ * Pipelining
+ *   a connection that starts with "pipeline" stays open and takes one
+ *   command per line, every line is answered with "key state" or
+ *   "E reason" in order, "E busy MS" over the limits. Clients may send
+ *   many lines before reading.
+ *     printf 'pipeline\n100001161\n100001081\n' | nc -q1 localhost 11337
+ *     10000116 1
+ *     10000108 1
+ *   "pipeline stagger=MS" switches plugs of one circuit on at least MS
+ *   apart, see rf433-tx.cpp
+ *
+ * Lanes
+ *   switch commands queue in the interactive lane, or in the bulk lane
+ *   when prefixed with "bulk ", sent over "pipeline bulk" or to the
+ *   --bulk-socket. Interactive frames go on air first, a bulk frame at
+ *   the latest after 4 interactive ones.
+ *     echo bulk 100001161 | nc localhost 11337
+ *
+ * State changes
+ *   a connection that sends "subscribe" stays open and receives one line
+ *   per state change: key, new state, source (n)etwork/(t)imer/(r)eceiver
+ *   and the time in milliseconds since the epoch
+ *     echo subscribe | nc localhost 11337
+ *     10000116 1 n 1760853922123
+ *
  */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
 
 #include "rf433-daemon.h"
-#include "./rc-switch/RCSwitch.h"
+#include "rf433-http.h"
+#include "rf433-events.h"
+#include "rf433-stats.h"
+#include "rf433-log.h"
+#include "rf433-trace.h"
+#include "rf433-tx.h"
+#include "rf433-capture.h"
+#include "rf433-journal.h"
+#include "rf433-history.h"
+#include "rf433-schedule.h"
+#include "rf433-config.h"
+
+int nPlugs;
+int PORT = 11337;
+bool httpMetrics = false;
 
-RCSwitch mySwitch;
+struct Listener {
+	int fd;
+	int kind;
+	int lane;
+};
+
+Listener listeners[MAX_LISTENERS];
+int nListeners = 0;
+Connection connections[MAX_CONNECTIONS];
+int nWorkers = 0;
+int idleExit = 0;
+std::atomic<int> nextWorker(1);
+std::atomic<int> openConnections(0);
+std::atomic<long> lastActive(0);
+
+void addListener(int fd, int kind, int lane = TX_LANE_INTERACTIVE);
+bool acceptConnection(Listener* listener, int worker);
+void flushConnection(Connection* conn);
+void serveConnection(Connection* conn, short revents);
+int inheritListeners();
+unsigned long peerKey(int fd);
+void pipelineProcess(Connection* conn);
+int resultLine(const CommandResult* result, char* out);
+int runScene(const char* name, int stagger, char* out, int size);
+bool deviceCommand(const char* buffer, char* name, int* action);
+void flushSubscribers(int worker);
+void serveShard(int worker);
+PI_THREAD(workerThread);
 
 int main(int argc, char* argv[]) {
+	const char* socketPath = NULL;
+	const char* bulkPath = NULL;
+	int socketMode = 0660;
+	int httpPort = 0;
+	int level = LOG_INFO;
+	bool portSet = false;
+	double rate = 2;
+	double burst = 20;
+	long budget = 10000;
+	double duty = 0;
+	long dutyWindow = 600;
+	const char* capturePath = NULL;
+	char* journalPath = NULL;
+	long journalSize = 0;
+	const char* historyPath = NULL;
+	const char* schedulePath = NULL;
+	const char* configPath = NULL;
+
+	int c;
+	while (1) {
+		static struct option long_options[] =
+			{
+			  {"airtime-budget", required_argument, 0, 'a'},
+			  {"bulk-socket", required_argument, 0, 'b'},
+			  {"capture", required_argument, 0, 'C'},
+			  {"config", required_argument, 0, 'c'},
+			  {"duty-cycle", required_argument, 0, 'D'},
+			  {"help", no_argument, 0, 'h'},
+			  {"history", required_argument, 0, 'S'},
+			  {"http", required_argument, 0, 'H'},
+			  {"idle-exit", required_argument, 0, 'x'},
+			  {"journal", required_argument, 0, 'J'},
+			  {"log-level", required_argument, 0, 'v'},
+			  {"metrics", no_argument, 0, 'M'},
+			  {"port", required_argument, 0, 'p'},
+			  {"rate", required_argument, 0, 'r'},
+			  {"schedules", required_argument, 0, 'T'},
+			  {"socket", required_argument, 0, 's'},
+			  {"socket-mode", required_argument, 0, 'm'},
+			  {"workers", required_argument, 0, 'w'},
+			  {0, 0, 0, 0}
+			};
+		int option_index = 0;
+
+		c = getopt_long(argc, argv, "a:b:c:C:D:hH:J:Mp:r:s:S:T:m:v:w:x:", long_options, &option_index);
+		if (c == -1)
+			break;
+
+		switch (c) {
+			case 'a':
+				budget = atol(optarg);
+				break;
+			case 'b':
+				bulkPath = optarg;
+				break;
+			case 'c':
+				configPath = optarg;
+				break;
+			case 'C':
+				capturePath = optarg;
+				break;
+			case 'D':
+				// PERCENT[:SECONDS]
+				duty = atof(optarg);
+				if (strchr(optarg, ':') != NULL) {
+					dutyWindow = atol(strchr(optarg, ':') + 1);
+				}
+				break;
+			case 'H':
+				httpPort = atoi(optarg);
+				break;
+			case 'J':
+				// PATH[:KB]
+				journalPath = optarg;
+				if (strrchr(optarg, ':') != NULL) {
+					journalSize = atol(strrchr(optarg, ':') + 1) * 1024;
+					*strrchr(optarg, ':') = '\0';
+				}
+				break;
+			case 'M':
+				httpMetrics = true;
+				break;
+			case 'v':
+				level = logParseLevel(optarg);
+				if (level < 0) {
+					printf("unknown log level: %s\n", optarg);
+					return 1;
+				}
+				break;
+			case 'p':
+				PORT = atoi(optarg);
+				portSet = true;
+				break;
+			case 'r':
+				// RATE[:BURST]
+				rate = atof(optarg);
+				if (strchr(optarg, ':') != NULL) {
+					burst = atof(strchr(optarg, ':') + 1);
+				}
+				break;
+			case 's':
+				socketPath = optarg;
+				break;
+			case 'S':
+				historyPath = optarg;
+				break;
+			case 'T':
+				schedulePath = optarg;
+				break;
+			case 'm':
+				socketMode = strtol(optarg, NULL, 8);
+				break;
+			case 'w':
+				nWorkers = atoi(optarg);
+				break;
+			case 'x':
+				idleExit = atoi(optarg);
+				break;
+			case 'h':
+			default:
+				printUsage();
+				return c == 'h' ? 0 : 1;
+		}
+	}
+	if (nWorkers <= 0) {
+		nWorkers = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	if (nWorkers > MAX_WORKERS) {
+		nWorkers = MAX_WORKERS;
+	}
+	int inherited = inheritListeners();
+	if (inherited == 0 && PORT == 0 && socketPath == NULL && bulkPath == NULL) {
+		printf("neither TCP port nor unix socket configured\n");
+		return 1;
+	}
+	logInit(level);
+
 	/**
-	* Setup wiringPi and RCSwitch
-	* set high priority scheduling
+	* Setup RCSwitch, wiringPi follows with the first transmission
 	*/
-	if (wiringPiSetup () == -1) {
+	//nPlugs=1280;
+	nPlugs = protocolInit();
+	stateInit(nPlugs);
+	if (!configInit(configPath)) {
 		return 1;
 	}
-	piHiPri(20);
-	mySwitch = RCSwitch();
-	mySwitch.setPulseLength(300);
-	usleep(50000);
-	mySwitch.enableTransmit(0);
-	//nPlugs=1280;
-	nPlugs=3328; // increased for Zap switched to avoid ovelap with Elro
-	int nState[nPlugs];
-	nTimeout=0;
-	memset(nState, 0, sizeof(nState));
+	if (!historyInit(historyPath)) {
+		error("ERROR opening history");
+	}
+	if (journalPath != NULL && !journalOpen(journalPath, journalSize)) {
+		error("ERROR opening journal");
+	}
+	txDutyCycle(duty, dutyWindow);
+	txInit(rate, burst, budget);
+	if (capturePath != NULL && !captureOpen(capturePath)) {
+		error("ERROR opening capture");
+	}
+	if (!scheduleInit(schedulePath)) {
+		error("ERROR starting schedules");
+	}
 
 	/**
-	* setup socket
+	* setup sockets
+	* a client that goes away must not kill the daemon with SIGPIPE
 	*/
-	int sockfd, newsockfd, portno;
-	socklen_t clilen;
-	char buffer[256];
-	struct sockaddr_in serv_addr, cli_addr;
-	int n;
-
-	bzero((char *) &serv_addr, sizeof(serv_addr));
-	portno = PORT;
-	serv_addr.sin_family = AF_INET;
-	serv_addr.sin_addr.s_addr = INADDR_ANY;
-	serv_addr.sin_port = htons(portno);
-	// receiving socket
-	sockfd = socket(AF_INET, SOCK_STREAM, 0);
-	if (sockfd < 0) {
-		error("ERROR opening socket");
+	signal(SIGPIPE, SIG_IGN);
+	if (PORT != 0 && (inherited == 0 || portSet)) {
+		addListener(openTcpListener(PORT), CONN_RAW);
 	}
-	if (bind(sockfd, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0) {
-		error("ERROR on binding");
+	if (socketPath != NULL) {
+		addListener(openUnixListener(socketPath, socketMode), CONN_RAW);
 	}
-	// sending socket
-	newsockfd = socket(AF_INET, SOCK_STREAM, 0);
-	if (newsockfd < 0) {
-		error("ERROR opening socket");
+	if (bulkPath != NULL) {
+		addListener(openUnixListener(bulkPath, socketMode), CONN_RAW, TX_LANE_BULK);
+	}
+	if (httpPort != 0) {
+		addListener(openTcpListener(httpPort), CONN_HTTP);
 	}
+	for (int i = 0; i < MAX_CONNECTIONS; i++) {
+		connections[i].fd = -1;
+	}
+	eventsInit(nWorkers);
 
 	/*
-	* start listening
+	* start listening, the main thread is worker 0
 	*/
+	lastActive.store(statsNow());
+	for (int i = 1; i < nWorkers; i++) {
+		if (piThreadCreate(workerThread) != 0) {
+			error("ERROR starting worker");
+		}
+	}
+	LOG_I("%d workers", nWorkers);
+	serveShard(0);
+
+	/**
+	 * terminate
+	 */
+	for (int i = 0; i < nListeners; i++) {
+		close(listeners[i].fd);
+	}
+	if (socketPath != NULL) {
+		unlink(socketPath);
+	}
+	if (bulkPath != NULL) {
+		unlink(bulkPath);
+	}
+	captureFlush();
+	logFlush();
+	return 0;
+}
+
+/**
+ * poll loop of one worker
+ * every worker polls all listeners and accepts into its own shard of the
+ * connection table, so requests are parsed and answered on all cores;
+ * only the frames meet again in the transmit queue
+ */
+void serveShard(int worker) {
+	int shardSize = MAX_CONNECTIONS / nWorkers;
+	Connection* shard = &connections[worker * shardSize];
+	struct pollfd fds[MAX_LISTENERS + 1 + MAX_CONNECTIONS];
+	Connection* polled[MAX_CONNECTIONS];
 	while (true) {
-		listen(sockfd,5);
-		clilen = sizeof(cli_addr);
-		newsockfd = accept(sockfd,(struct sockaddr *) &cli_addr,&clilen);
-		if (newsockfd < 0) {
-			error("ERROR on accept");
-		}
-		bzero(buffer,256);
-		n = read(newsockfd,buffer,255);
-		if (n < 0) {
-			error("ERROR reading from socket");
+		int nfds = 0;
+		for (int i = 0; i < nListeners; i++) {
+			fds[nfds].fd = listeners[i].fd;
+			fds[nfds].events = POLLIN;
+			nfds++;
 		}
-		/*
-		* get values
-		*/
-		printf("message: %s\n", buffer);
-		if (strlen(buffer) >= 5) {
-			nSys = buffer[0]-48;
-			switch (nSys) {
-				//normal elro
-				case 1:{
-					for (int i=1; i<6; i++) {
-						nGroup[i-1] = buffer[i];
-					}
-					nGroup[5] = '\0';
-					nSwitchNumber = (buffer[6]-48)*10;
-					nSwitchNumber += (buffer[7]-48);
-// ###############################################################################
-					// need to convert nSwitchNumber to binary string
-					getBin(nSwitchNumber,nSwitch);
-					nAction = buffer[8]-48;
-					nTimeout=0;
-					printf("nSys: %i\n", nSys);
-					printf("nGroup: %s\n", nGroup);
-					printf("nSwitchNumber: %s\n", nSwitch);
-					printf("nAction: %i\n", nAction);
-
-					if (strlen(buffer) >= 10) nTimeout = buffer[9]-48;
-					if (strlen(buffer) >= 11) nTimeout = nTimeout*10+buffer[10]-48;
-					if (strlen(buffer) >= 12) nTimeout = nTimeout*10+buffer[11]-48;
-
-					/**
-					* handle messages
-					*/
-					int nAddr = getAddrElro(nGroup, nSwitchNumber);
-					printf("nAddr: %i\n", nAddr);
-					printf("nPlugs: %i\n", nPlugs);
-					char msg[13];
-					if (nAddr > 1023 || nAddr < 0) {
-						printf("Switch out of range: %s:%d\n", nGroup, nSwitchNumber);
-						n = write(newsockfd,"2",1);
-					}
-					else {
-						mySwitch.setProtocol(1,350);
-						switch (nAction) {
-							//OFF
-							case 0:{
-								//piThreadCreate(switchOff);
-								mySwitch.switchOff(nGroup, nSwitchNumber);
-								nState[nAddr] = 0;
-								//sprintf(msg, "nState[%d] = %d", nAddr, nState[nAddr]);
-								sprintf(msg, "Off %d\n", nState[nAddr]);
-								n = write(newsockfd,msg,1);
-								break;
-							}
-							//ON
-							case 1:{
-								//piThreadCreate(switchOn);
-								mySwitch.switchOn(nGroup, nSwitchNumber);
-								nState[nAddr] = 1;
-								//sprintf(msg, "nState[%d] = %d", nAddr, nState[nAddr]);
-								sprintf(msg, "On %d\n", nState[nAddr]);
-								n = write(newsockfd,msg,1);
-								break;
-							}
-							//STATUS
-							case 2:{
-								//sprintf(msg, "nState[%d] = %d\n", nAddr, nState[nAddr]);
-								sprintf(msg, "%d\n", nState[nAddr]);
-								n = write(newsockfd,msg,1);
-								break;
-							}
-						}
-					}
-					break;
+		fds[nfds].fd = eventsWakeFd(worker);
+		fds[nfds].events = POLLIN;
+		nfds++;
+		int nPolled = 0;
+		for (int i = 0; i < shardSize; i++) {
+			Connection* conn = &shard[i];
+			if (conn->fd < 0) {
+				continue;
+			}
+			fds[nfds].fd = conn->fd;
+			fds[nfds].events = conn->outPos < conn->outLen ? POLLOUT : POLLIN;
+			if (conn->kind == CONN_SUBSCRIBER && conn->eventBlocked) {
+				fds[nfds].events |= POLLOUT;
+			}
+			polled[nPolled++] = conn;
+			nfds++;
+		}
+		// worker 0 watches for the whole daemon being idle
+		int timeout = -1;
+		if (worker == 0 && idleExit > 0) {
+			timeout = idleExit * 1000;
+			if (openConnections.load() == 0) {
+				long idle = (statsNow() - lastActive.load()) / 1000;
+				if (idle >= idleExit * 1000L) {
+					LOG_I("no clients for %d s, exiting", idleExit);
+					return;
 				}
-
-				//Intertechno
-				case 2:{
-					mySwitch.setProtocol(1,300);
-					nGroup[0] = buffer[1];
-					nGroup[1] = buffer[2];
-					nGroup[2] = '\0';
-					nSwitchNumber = (buffer[3]-48)*10;
-					nSwitchNumber += (buffer[4]-48);
-					getBin(nSwitchNumber,nSwitch);
-					nAction = buffer[5]-48;
-					nTimeout=0;
-					printf("nSys: %i\n", nSys);
-					printf("nGroup: %s\n", nGroup);
-					printf("nSwitchNumber: %s\n", nSwitch);
-					printf("nAction: %i\n", nAction);
-					int nAddr = getAddrInt(nGroup, nSwitchNumber);
-					printf("nAddr: %i\n", nAddr);
-					printf("nPlugs: %i\n", nPlugs);
-					char msg[13];
-					if (nAddr > 1279 || nAddr < 1024) {
-						printf("Switch out of range: %s:%d\n", nGroup, nSwitchNumber);
-						n = write(newsockfd,"2",1);
-					}
-					else {
-						printf("computing systemcode for Intertechno Type B house[%s] unit[%i] ... ",nGroup, nSwitchNumber);
-						char pSystemCode[14];
-						switch (atoi(nGroup)) {
-							// house/family code A=1 - P=16
-							case 1:   { printf("1/A ... ");   strcpy(pSystemCode,"0000"); break; }
-							case 2:   { printf("2/B ... ");   strcpy(pSystemCode,"F000"); break; }
-							case 3:   { printf("3/C ... ");   strcpy(pSystemCode,"0F00"); break; }
-							case 4:   { printf("4/D ... ");   strcpy(pSystemCode,"FF00"); break; }
-							case 5:   { printf("5/E ... ");   strcpy(pSystemCode,"00F0"); break; }
-							case 6:   { printf("6/F ... ");   strcpy(pSystemCode,"F0F0"); break; }
-							case 7:   { printf("7/G ... ");   strcpy(pSystemCode,"0FF0"); break; }
-							case 8:   { printf("8/H ... ");   strcpy(pSystemCode,"FFF0"); break; }
-							case 9:   { printf("9/I ... ");   strcpy(pSystemCode,"000F"); break; }
-							case 10:  { printf("10/J ... ");  strcpy(pSystemCode,"F00F"); break; }
-							case 11:  { printf("11/K ... ");  strcpy(pSystemCode,"0F0F"); break; }
-							case 12:  { printf("12/L ... ");  strcpy(pSystemCode,"FF0F"); break; }
-							case 13:  { printf("13/M ... ");  strcpy(pSystemCode,"00FF"); break; }
-							case 14:  { printf("14/N ... ");  strcpy(pSystemCode,"F0FF"); break; }
-							case 15:  { printf("15/O ... ");  strcpy(pSystemCode,"0FFF"); break; }
-							case 16:  { printf("16/P ... ");  strcpy(pSystemCode,"FFFF"); break; }
-							default:{
-								printf("systemCode[%s] is unsupported\n", nGroup);
-								return -1;
-							}
-						}
-						printf("got systemCode[%s] ",nGroup);
-						switch (nSwitchNumber) {
-							// unit/group code 01-16
-							case 1:   { printf("1 ... ");   strcat(pSystemCode,"0000"); break; }
-							case 2:   { printf("2 ... ");   strcat(pSystemCode,"F000"); break; }
-							case 3:   { printf("3 ... ");   strcat(pSystemCode,"0F00"); break; }
-							case 4:   { printf("4 ... ");   strcat(pSystemCode,"FF00"); break; }
-							case 5:   { printf("5 ... ");   strcat(pSystemCode,"00F0"); break; }
-							case 6:   { printf("6 ... ");   strcat(pSystemCode,"F0F0"); break; }
-							case 7:   { printf("7 ... ");   strcat(pSystemCode,"0FF0"); break; }
-							case 8:   { printf("8 ... ");   strcat(pSystemCode,"FFF0"); break; }
-							case 9:   { printf("9 ... ");   strcat(pSystemCode,"000F"); break; }
-							case 10:  { printf("10 ... ");  strcat(pSystemCode,"F00F"); break; }
-							case 11:  { printf("11 ... ");  strcat(pSystemCode,"0F0F"); break; }
-							case 12:  { printf("12 ... ");  strcat(pSystemCode,"FF0F"); break; }
-							case 13:  { printf("13 ... ");  strcat(pSystemCode,"00FF"); break; }
-							case 14:  { printf("14 ... ");  strcat(pSystemCode,"F0FF"); break; }
-							case 15:  { printf("15 ... ");  strcat(pSystemCode,"0FFF"); break; }
-							case 16:  { printf("16 ... ");  strcat(pSystemCode,"FFFF"); break; }
-							default:{
-								printf("unitCode[%i] is unsupported\n", nSwitchNumber);
-								return -1;
-							}
-		 				}
-						strcat(pSystemCode,"0F"); // mandatory bits
-						switch(nAction) {
-							case 0:{
-								strcat(pSystemCode,"F0");
-								mySwitch.sendTriState(pSystemCode);
-								printf("sent TriState signal: pSystemCode[%s]\n",pSystemCode);
-								nState[nAddr] = 0;
-								//sprintf(msg, "nState[%d] = %d", nAddr, nState[nAddr]);
-								sprintf(msg, "%d", nState[nAddr]);
-								n = write(newsockfd,msg,1);
-								break;
-							}
-							case 1:{
-								strcat(pSystemCode,"FF");
-								mySwitch.sendTriState(pSystemCode);
-								printf("sent TriState signal: pSystemCode[%s]\n",pSystemCode);
-								nState[nAddr] = 1;
-								//sprintf(msg, "nState[%d] = %d", nAddr, nState[nAddr]);
-								sprintf(msg, "%d", nState[nAddr]);
-								n = write(newsockfd,msg,1);
-								break;
-							}
-							case 2:{
-								sprintf(msg, "nState[%d] = %d", nAddr, nState[nAddr]);
-								sprintf(msg, "%d", nState[nAddr]);
-								n = write(newsockfd,msg,1);
-								break;
-							}
-							default:{
-								printf("command[%i] is unsupported\n", nAction);
-								return -1;
-							}
-						}
-					}
+				timeout = idleExit * 1000L - idle;
+			}
+		}
+		int ready = poll(fds, nfds, timeout);
+		if (ready < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			error("ERROR on poll");
+		}
+		if (idleExit > 0 && (ready > 0 || nPolled > 0)) {
+			lastActive.store(statsNow(), std::memory_order_relaxed);
+		}
+		for (int i = 0; i < nListeners; i++) {
+			// take a burst of clients, leave the rest to the other workers
+			for (int n = 0; n < 16 && (fds[i].revents & POLLIN); n++) {
+				if (!acceptConnection(&listeners[i], worker)) {
 					break;
 				}
+			}
+		}
+		if (fds[nListeners].revents & POLLIN) {
+			eventsDrainWake(worker);
+		}
+		for (int i = 0; i < nPolled; i++) {
+			if (fds[nListeners + 1 + i].revents != 0) {
+				serveConnection(polled[i], fds[nListeners + 1 + i].revents);
+			}
+		}
+		flushSubscribers(worker);
+	}
+}
+
+PI_THREAD(workerThread) {
+	serveShard(nextWorker.fetch_add(1));
+	return 0;
+}
+
+void addListener(int fd, int kind, int lane) {
+	if (nListeners == MAX_LISTENERS) {
+		printf("too many listeners\n");
+		exit(1);
+	}
+	// all workers poll the listeners, the ones losing the race must not block
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	listeners[nListeners].fd = fd;
+	listeners[nListeners].kind = kind;
+	listeners[nListeners].lane = lane;
+	nListeners++;
+}
+
 /**
- * ZAP-Code   Group   (0=open)  | Switch 5..1 (ex.5)| On=01 Off=10    
- * send code  1   1   0   0   0 | 1   0   0   0   0 |
- * tri-state  0   0   F   F   F | 1   F   F   0   0 | 1   0
- * binary     00  00  01  01  01| 11  01  01  00  00| 00  11 
+ * accept a client into a free connection slot of the worker's shard
+ * returns false when no client was waiting
  */
-				case 3:{
-					for (int i=1; i<6; i++) {
-						nGroup[i-1] = buffer[i];
-					}
-					nGroup[5] = '\0';
-					nSwitchNumber = (buffer[6]-48)*10;
-					nSwitchNumber += (buffer[7]-48);
-					nAction = buffer[8]-48;
-					nTimeout=0;
-					printf("nSys: %i\n", nSys);
-					printf("nGroup: %s\n", nGroup);
-					printf("nSwitchNumber: %i\n", nSwitchNumber);
-					printf("nAction: %i\n", nAction);
-
-					if (strlen(buffer) >= 10) nTimeout = buffer[9]-48;
-					if (strlen(buffer) >= 11) nTimeout = nTimeout*10+buffer[10]-48;
-					if (strlen(buffer) >= 12) nTimeout = nTimeout*10+buffer[11]-48;
-
-					/**
-					* handle messages
-					*/
-					int nZapCode = getDecimalZap(nGroup, nSwitchNumber, nAction);
-					int nAddr = getAddrElro(nGroup, nSwitchNumber)+2048; // use same switch address calculation as for Elro
-// test fixed nAddr
-//					int nAddr = 123;
-					printf("nAddr: %i\n", nAddr);
-					printf("nPlugs: %i\n", nPlugs);
-					char msg[13];
-					if (nZapCode > 5600524 || nZapCode < 5424) {
-						printf("Switch out of range: %s:%d\n", nGroup, nSwitchNumber);
-						n = write(newsockfd,"2",1);
-					}
-					else {
-						mySwitch.setProtocol(1,188);
-						//switch Zap 5 on (for testing)
-						//mySwitch.send (357635,24);
-						//switch Zap 5 off (for testing)
-						//mySwitch.send (357644,24);
-						//mySwitch.send (nAddr,24);
-						switch (nAction) {
-							//OFF
-							case 0:{
-								//piThreadCreate(switchOff);
-								//mySwitch.send (nZapCode,24);
-								mySwitch.switchOnZap (nGroup,nSwitchNumber);
-								nState[nAddr] = 0;
-								//sprintf(msg, "nState[%d] = %d", nAddr, nState[nAddr]);
-								sprintf(msg, "%d", nState[nAddr]);
-								n = write(newsockfd,msg,1);
-								break;
-							}
-							//ON
-							case 1:{
-								//piThreadCreate(switchOn);
-								//mySwitch.send (nZapCode,24);
-								mySwitch.switchOffZap (nGroup,nSwitchNumber);
-								nState[nAddr] = 1;
-								//sprintf(msg, "nState[%d] = %d", nAddr, nState[nAddr]);
-								sprintf(msg, "%d", nState[nAddr]);
-								n = write(newsockfd,msg,1);
-								break;
-							}
-							//STATUS
-							case 2:{
-								sprintf(msg, "nState[%d] = %d", nAddr, nState[nAddr]);
-								sprintf(msg, "%d", nState[nAddr]);
-								n = write(newsockfd,msg,1);
-								break;
-							}
-						}
-					}
-					break;
-				}
+bool acceptConnection(Listener* listener, int worker) {
+	int newsockfd = accept(listener->fd, NULL, NULL);
+	if (newsockfd < 0) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK) {
+			perror("ERROR on accept");
+		}
+		return false;
+	}
+	int shardSize = MAX_CONNECTIONS / nWorkers;
+	Connection* conn = NULL;
+	for (int i = worker * shardSize; i < (worker + 1) * shardSize; i++) {
+		if (connections[i].fd < 0) {
+			conn = &connections[i];
+			break;
+		}
+	}
+	if (conn == NULL) {
+		LOG_W("too many connections");
+		close(newsockfd);
+		return true;
+	}
+	fcntl(newsockfd, F_SETFL, fcntl(newsockfd, F_GETFL) | O_NONBLOCK);
+	conn->fd = newsockfd;
+	openConnections.fetch_add(1);
+	conn->kind = listener->kind;
+	conn->out = NULL;
+	conn->outPos = 0;
+	conn->outLen = 0;
+	conn->closeAfterWrite = false;
+	conn->readyAt = statsNow();
+	conn->client = peerKey(newsockfd);
+	conn->lane = listener->lane;
+	conn->stagger = 0;
+	if (conn->kind == CONN_HTTP) {
+		httpOpen(conn);
+	}
+	return true;
+}
 
-				default:{
-					printf("wrong systemkey!\n");
-				}
-			}
+/**
+ * who is connected, for the rate limit: the IPv4 address, the uid of a
+ * unix socket peer or 0 if unknown, which is not limited
+ */
+unsigned long peerKey(int fd) {
+	struct sockaddr_storage addr;
+	socklen_t len = sizeof(addr);
+	if (getpeername(fd, (struct sockaddr*) &addr, &len) < 0) {
+		return 0;
+	}
+	if (addr.ss_family == AF_INET) {
+		return ntohl(((struct sockaddr_in*) &addr)->sin_addr.s_addr);
+	}
+	if (addr.ss_family == AF_UNIX) {
+		struct ucred cred;
+		len = sizeof(cred);
+		if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0) {
+			return (1UL << 32) | cred.uid;
 		}
-		else {
-			printf("message corrupted or incomplete");
+	}
+	return 0;
+}
+
+/**
+ * push pending state changes to all subscribers straight from the
+ * shared event ring, subscribers that fell a whole ring behind are dropped
+ */
+void flushSubscribers(int worker) {
+	unsigned long head = eventsHead();
+	int shardSize = MAX_CONNECTIONS / nWorkers;
+	for (int i = worker * shardSize; i < (worker + 1) * shardSize; i++) {
+		Connection* conn = &connections[i];
+		if (conn->fd < 0 || conn->kind != CONN_SUBSCRIBER || conn->eventBlocked || conn->eventCursor == head) {
+			continue;
 		}
+		int n = eventsWrite(conn->fd, &conn->eventCursor, &conn->eventOffset);
 		if (n < 0) {
-			error("ERROR writing to socket");
-			close(newsockfd);
+			closeConnection(conn);
+		}
+		else if (n > 0) {
+			conn->eventBlocked = true;
 		}
 	}
+}
 
-	/**
-	 * terminate
-	 */
-	//close(newsockfd);
-	close(sockfd);
-	return 0;
+/**
+ * the worker whose shard holds the connection
+ */
+static int connectionWorker(Connection* conn) {
+	return (conn - connections) / (MAX_CONNECTIONS / nWorkers);
+}
+
+void closeConnection(Connection* conn) {
+	if (conn->kind == CONN_SUBSCRIBER) {
+		eventsUnsubscribe(connectionWorker(conn));
+		conn->kind = CONN_RAW;
+	}
+	openConnections.fetch_sub(1);
+	close(conn->fd);
+	conn->fd = -1;
+	conn->outPos = 0;
+	conn->outLen = 0;
 }
 
 /**
- * error output
+ * queue data for the client and write as much as possible right away,
+ * the rest goes out when poll reports the socket writable
+ * data must stay valid until it is written
  */
-void error(const char *msg) {
-	perror(msg);
-	exit(1);
+void sendConnection(Connection* conn, const char* data, int len) {
+	conn->out = data;
+	conn->outPos = 0;
+	conn->outLen = len;
+	flushConnection(conn);
+}
+
+void flushConnection(Connection* conn) {
+	while (conn->outPos < conn->outLen) {
+		int n = write(conn->fd, conn->out + conn->outPos, conn->outLen - conn->outPos);
+		if (n < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				return;
+			}
+			perror("ERROR writing to socket");
+			closeConnection(conn);
+			return;
+		}
+		conn->outPos += n;
+	}
+	conn->outPos = 0;
+	conn->outLen = 0;
+	if (conn->closeAfterWrite) {
+		closeConnection(conn);
+	}
+	else if (conn->kind == CONN_HTTP) {
+		// pipelined requests waited for this response
+		httpProcess(conn);
+	}
+	else if (conn->kind == CONN_PIPELINE) {
+		pipelineProcess(conn);
+	}
 }
 
 /**
- * calculate the array address of the power state for elro
+ * answer the complete lines of a pipelined connection, as many as fit
+ * into one write
  */
-int getAddrElro(const char* nGroup, int nSwitchNumber) {
-	int tempgroup = atoi(nGroup);
-	int group = 0;
-	for (int i = 0; i < 5; i++) {
-		if ((tempgroup % 10) == 1) {
-			group = group | (1 << i);
+void pipelineProcess(Connection* conn) {
+	HttpBuffers* buffers = conn->http;
+	char* out = buffers->out;
+	int len = 0;
+	int used = 0;
+	if (conn->fd < 0 || conn->outLen > 0) {
+		return;
+	}
+	while (len < (int) sizeof(buffers->out) - 64) {
+		char* line = buffers->in + used;
+		char* end = (char*) memchr(line, '\n', buffers->inLen - used);
+		if (end == NULL) {
+			break;
+		}
+		*end = '\0';
+		used = end + 1 - buffers->in;
+		if (end > line && end[-1] == '\r') {
+			end[-1] = '\0';
+		}
+		if (line[0] == '\0') {
+			continue;
 		}
-		tempgroup = tempgroup / 10;
+		CommandResult result;
+		TraceRecord* trace = traceBegin(conn->readyAt, line);
+		handleMessage(line, EVENT_SOURCE_NETWORK, conn->lane, conn->client, &result, conn->stagger);
+		traceEnd(trace, result.addr, result.status);
+		len += resultLine(&result, out + len);
 	}
+	memmove(buffers->in, buffers->in + used, buffers->inLen - used);
+	buffers->inLen -= used;
+	if (buffers->inLen == HTTP_IN_SIZE) {
+		// a line longer than the whole buffer
+		closeConnection(conn);
+		return;
+	}
+	if (len > 0) {
+		sendConnection(conn, out, len);
+	}
+}
 
-	int switchnr = nSwitchNumber & 0b00011111;
-	int result = (group << 5) | switchnr;
-	return result;
+/**
+ * "key state" or "E reason" of a pipelined command
+ */
+int resultLine(const CommandResult* result, char* out) {
+	if (result->status == RESULT_OK) {
+		char key[16];
+		protocolKey(result->addr, key);
+		return sprintf(out, "%s %d\n", key, result->state);
+	}
+	if (result->status == RESULT_BUSY) {
+		return sprintf(out, "E busy %d\n", result->retryAfter);
+	}
+	return sprintf(out, "E %s\n", result->status == RESULT_RANGE ? "range" : "invalid");
 }
 
 /**
- * calculate the array address of the power state for intertechno
+ * queue the frames of a scene of the config in the bulk lane, one
+ * result line per plug, stagger -1 for the scene's own
  */
-int getAddrInt(const char* nGroup, int nSwitchNumber) {
-	return ((atoi(nGroup) - 1) * 16) + (nSwitchNumber - 1) + 1024;
+int runScene(const char* name, int stagger, char* out, int size) {
+	// submitting takes the queue lock, which a config reader must not
+	// wait for, so the items are copied out first
+	ConfigSceneItem items[CONFIG_SCENE_ITEMS];
+	int count = -1;
+	const Config* config = configEnter();
+	const ConfigScene* scene = configScene(config, name);
+	if (scene != NULL) {
+		count = scene->count;
+		memcpy(items, &config->items[scene->first], sizeof(ConfigSceneItem) * count);
+		if (stagger < 0) {
+			stagger = scene->stagger;
+		}
+	}
+	configExit();
+	if (count < 0) {
+		return snprintf(out, size, "E range\n");
+	}
+	int len = 0;
+	for (int i = 0; i < count && len < size - 64; i++) {
+		const ConfigSceneItem* item = &items[i];
+		char command[20];
+		int n = protocolKey(item->addr, command);
+		command[n] = '0' + item->state;
+		command[n + 1] = '\0';
+		// the scene is configured, not the client: the airtime budget
+		// applies, the rate limit doesn't
+		CommandResult result;
+		handleMessage(command, EVENT_SOURCE_NETWORK, TX_LANE_BULK, 0, &result, stagger);
+		len += resultLine(&result, out + len);
+	}
+	return len;
+}
+
+void serveConnection(Connection* conn, short revents) {
+	if (conn->outPos < conn->outLen) {
+		if (revents & (POLLOUT | POLLERR | POLLHUP)) {
+			flushConnection(conn);
+		}
+		return;
+	}
+	if (conn->kind == CONN_HTTP) {
+		httpRead(conn);
+		return;
+	}
+	if (conn->kind == CONN_PIPELINE) {
+		HttpBuffers* buffers = conn->http;
+		int n = read(conn->fd, buffers->in + buffers->inLen, HTTP_IN_SIZE - buffers->inLen);
+		if (n <= 0) {
+			if (n < 0 && errno == EAGAIN) {
+				return;
+			}
+			closeConnection(conn);
+			return;
+		}
+		buffers->inLen += n;
+		conn->readyAt = statsNow();
+		pipelineProcess(conn);
+		return;
+	}
+	if (conn->kind == CONN_SUBSCRIBER) {
+		if (revents & POLLOUT) {
+			conn->eventBlocked = false;
+		}
+		if (revents & (POLLIN | POLLERR | POLLHUP)) {
+			// subscribers don't send anything, readable means closed
+			char buffer[64];
+			int n = read(conn->fd, buffer, sizeof(buffer));
+			if (n == 0 || (n < 0 && errno != EAGAIN)) {
+				closeConnection(conn);
+			}
+		}
+		return;
+	}
+
+	/*
+	* raw protocol: one message per connection
+	*/
+	char buffer[256];
+	bzero(buffer,256);
+	int n = read(conn->fd,buffer,255);
+	if (n <= 0) {
+		if (n < 0 && errno == EAGAIN) {
+			return;
+		}
+		closeConnection(conn);
+		return;
+	}
+	if (strncmp(buffer, "stats", 5) == 0) {
+		httpOpen(conn);
+		int len = statsRender(conn->http->out, sizeof(conn->http->out));
+		conn->closeAfterWrite = true;
+		sendConnection(conn, conn->http->out, len);
+		return;
+	}
+	if (strncmp(buffer, "traces", 6) == 0) {
+		httpOpen(conn);
+		int len = traceDump(conn->http->out, sizeof(conn->http->out));
+		conn->closeAfterWrite = true;
+		sendConnection(conn, conn->http->out, len);
+		return;
+	}
+	if (strncmp(buffer, "history", 7) == 0) {
+		httpOpen(conn);
+		int len = historyQuery(buffer + 7, conn->http->out, sizeof(conn->http->out));
+		conn->closeAfterWrite = true;
+		sendConnection(conn, conn->http->out, len);
+		return;
+	}
+	if (strncmp(buffer, "schedule", 8) == 0) {
+		httpOpen(conn);
+		int len = scheduleCommand(buffer + 8, conn->http->out, sizeof(conn->http->out));
+		conn->closeAfterWrite = true;
+		sendConnection(conn, conn->http->out, len);
+		return;
+	}
+	if (strncmp(buffer, "scene ", 6) == 0) {
+		char name[CONFIG_NAME_SIZE];
+		httpOpen(conn);
+		int len = 0;
+		int stagger = -1;
+		if (sscanf(buffer + 6, "%31s stagger=%d", name, &stagger) >= 1) {
+			len = runScene(name, stagger, conn->http->out, sizeof(conn->http->out));
+		}
+		conn->closeAfterWrite = true;
+		sendConnection(conn, conn->http->out, len);
+		return;
+	}
+	if (strncmp(buffer, "sweep", 5) == 0) {
+		httpOpen(conn);
+		int len = txSweep(buffer + 5, conn->http->out, sizeof(conn->http->out));
+		conn->closeAfterWrite = true;
+		sendConnection(conn, conn->http->out, len);
+		return;
+	}
+	if (strncmp(buffer, "reload", 6) == 0) {
+		httpOpen(conn);
+		char message[256];
+		bool reloaded = configReload(message, sizeof(message));
+		int len = snprintf(conn->http->out, sizeof(conn->http->out), "%s %s\n", reloaded ? "O" : "E", message);
+		conn->closeAfterWrite = true;
+		sendConnection(conn, conn->http->out, len);
+		return;
+	}
+	if (strncmp(buffer, "bitmap", 6) == 0) {
+		httpOpen(conn);
+		int len = stateBitmap(conn->http->out, sizeof(conn->http->out));
+		conn->closeAfterWrite = true;
+		sendConnection(conn, conn->http->out, len);
+		return;
+	}
+	if (strncmp(buffer, "loglevel", 8) == 0) {
+		char name[16];
+		if (sscanf(buffer + 8, "%15s", name) == 1) {
+			int level = logParseLevel(name);
+			if (level >= 0) {
+				logLevel.store(level);
+			}
+		}
+		conn->reply[0] = '0' + logLevel.load();
+		conn->closeAfterWrite = true;
+		sendConnection(conn, conn->reply, 1);
+		return;
+	}
+	if (strncmp(buffer, "pipeline", 8) == 0) {
+		// the connection stays open, commands that came with the keyword
+		// are kept for pipelineProcess
+		conn->kind = CONN_PIPELINE;
+		if (strncmp(buffer + 8, " bulk", 5) == 0) {
+			conn->lane = TX_LANE_BULK;
+		}
+		const char* stagger = strstr(buffer, "stagger=");
+		char* rest = (char*) memchr(buffer, '\n', n);
+		if (stagger != NULL && (rest == NULL || stagger < rest)) {
+			conn->stagger = atoi(stagger + 8);
+		}
+		httpOpen(conn);
+		if (rest != NULL) {
+			rest++;
+			conn->http->inLen = n - (rest - buffer);
+			memcpy(conn->http->in, rest, conn->http->inLen);
+		}
+		pipelineProcess(conn);
+		return;
+	}
+	if (strncmp(buffer, "subscribe", 9) == 0) {
+		// the connection stays open and receives every state change
+		conn->kind = CONN_SUBSCRIBER;
+		conn->eventCursor = eventsSubscribe(connectionWorker(conn));
+		conn->eventOffset = 0;
+		conn->eventBlocked = false;
+		return;
+	}
+	/*
+	* "trace <command>" appends the trace of the command to the reply,
+	* "bulk <command>" queues it in the bulk lane, both can be combined
+	*/
+	const char* message = buffer;
+	bool traced = false;
+	int lane = conn->lane;
+	while (true) {
+		if (strncmp(message, "trace ", 6) == 0) {
+			traced = true;
+			message += 6;
+		}
+		else if (strncmp(message, "bulk ", 5) == 0) {
+			lane = TX_LANE_BULK;
+			message += 5;
+		}
+		else {
+			break;
+		}
+	}
+	CommandResult result;
+	TraceRecord* trace = traceBegin(conn->readyAt, message);
+	handleMessage(message, EVENT_SOURCE_NETWORK, lane, conn->client, &result);
+	traceEnd(trace, result.addr, result.status);
+	conn->closeAfterWrite = true;
+	if (traced) {
+		httpOpen(conn);
+		char* out = conn->http->out;
+		int len = 0;
+		if (result.reply != 0) {
+			out[len++] = result.reply;
+			out[len++] = ' ';
+		}
+		len += traceFormat(trace, out + len, sizeof(conn->http->out) - len);
+		sendConnection(conn, out, len);
+	}
+	else if (result.status == RESULT_BUSY) {
+		int len = snprintf(conn->reply, sizeof(conn->reply), "B %d\n", result.retryAfter);
+		sendConnection(conn, conn->reply, len);
+	}
+	else if (result.reply != 0) {
+		conn->reply[0] = result.reply;
+		sendConnection(conn, conn->reply, 1);
+	}
+	else {
+		closeConnection(conn);
+	}
 }
 
 /**
- * calculate the array address of the power state for Zap/REV
- * 
- * ZAP-Code   Group   (F=open)  | Switch 5..1       | On=01 Off=10  
- *                                5   4   3   2   1        
- * tri-state  0   0   F   F   F | 1   F   F   0   0 | 1   0
- * binary     00  00  01  01  01| 11  01  01  00  00| 00  11 
- * 
- * minimum address = 000000000001010100110000 = 5424
- * maximum address = 010101010111010100001100 = 5600524
+ * "on NAME", "off NAME" or "status NAME" of a configured device, the
+ * action as in numeric commands
  */
-int getDecimalZap(const char* nGroup, int nSwitchNumber, int nAction) {
-	int group = 0;
-	for (int i = 0; i < 5; i++) {
-		if (nGroup[i] == '1') { // 1 = closed="tri-0"
-			group <<= 2;
+bool deviceCommand(const char* buffer, char* name, int* action) {
+	static const char* verbs[] = { "off ", "on ", "status " };
+	for (int i = 0; i < 3; i++) {
+		int len = strlen(verbs[i]);
+		if (strncmp(buffer, verbs[i], len) == 0) {
+			*action = i;
+			return sscanf(buffer + len, "%31s", name) == 1;
 		}
-		else { // 0 = open = "tri-F" 
-			group = group << 2 | 1;
+	}
+	return false;
+}
+
+/**
+ * parse and execute one message in the daemon protocol
+ * the outcome, including the legacy one byte reply, is stored in result
+ * state changes are published to subscribers with the given source
+ * an on frame waits stagger ms after the last one of its circuit
+ */
+void handleMessage(const char* buffer, int source, int lane, unsigned long client, CommandResult* result, int stagger) {
+	result->sys = 0;
+	result->addr = -1;
+	result->state = 0;
+	result->status = RESULT_OK;
+	result->reply = 0;
+	result->retryAfter = 0;
+	CommandContext ctx;
+	TxFrame frame;
+	int newState = -1;
+	memset(&ctx, 0, sizeof(ctx));
+	/*
+	* get values, the system digit picks the parser
+	*/
+	LOG_I("message: %s", buffer);
+	if (source == EVENT_SOURCE_NETWORK) {
+		captureCommand(buffer, client, lane);
+	}
+	const Protocol* protocol = protocolFor(buffer[0]);
+	char name[CONFIG_NAME_SIZE];
+	if (protocol == NULL && deviceCommand(buffer, name, &ctx.action)) {
+		// by name: the config has the frames ready
+		const Config* config = configEnter();
+		int device = configDevice(config, name);
+		if (device < 0) {
+			LOG_W("unknown device: %s", name);
+			result->status = RESULT_RANGE;
 		}
+		else {
+			protocol = protocolFor('0' + config->devices[device].system);
+			ctx.sys = protocol->system;
+			result->addr = config->devices[device].addr;
+			if (ctx.action == 2) {
+				result->reply = '0' + stateGet(result->addr);
+			}
+			else {
+				frame = config->frames[device * 2 + ctx.action];
+				newState = ctx.action;
+				result->reply = frame.on ? protocol->onReply : protocol->offReply;
+			}
+		}
+		configExit();
+	}
+	else if (protocol == NULL) {
+		LOG_W("wrong systemkey!");
+	}
+	else if ((int) strlen(buffer) < protocol->minLength) {
+		LOG_W("message corrupted or incomplete");
 	}
-	//int switchnr = 0b11 << (2*(nSwitchNumber+1)) | 0b01010100000000;
-	int switchnr = 0b11 << (2*(nSwitchNumber+1));
-	if (nAction == 0) { //OFF
-		switchnr |= 0b01010100001100;
+	else {
+		ctx.sys = protocol->system;
+		result->status = protocol->parse(buffer, &ctx);
+		if (strlen(buffer) >= (size_t) protocol->minLength + 1) ctx.timeout = buffer[protocol->minLength]-48;
+		if (strlen(buffer) >= (size_t) protocol->minLength + 2) ctx.timeout = ctx.timeout*10+buffer[protocol->minLength + 1]-48;
+		if (strlen(buffer) >= (size_t) protocol->minLength + 3) ctx.timeout = ctx.timeout*10+buffer[protocol->minLength + 2]-48;
+		LOG_D("nSys: %i", ctx.sys);
+		LOG_D("nGroup: %s", ctx.group);
+		LOG_D("nSwitchNumber: %i", ctx.switchNumber);
+		LOG_D("nAction: %i", ctx.action);
+
+		/**
+		* handle messages
+		*/
+		if (result->status == RESULT_RANGE) {
+			LOG_W("Switch out of range: %s:%d", ctx.group, ctx.switchNumber);
+		}
+		else {
+			int nAddr = protocol->base + ctx.offset;
+			LOG_D("nAddr: %i", nAddr);
+			result->addr = nAddr;
+			switch (ctx.action) {
+				//OFF
+				case 0:
+				//ON
+				case 1:{
+					const Config* config = configEnter();
+					txBuild(&frame, protocol, &ctx, ctx.action == 1, config->pulse[nAddr] != 0 ? config->pulse[nAddr] : protocol->pulseLength);
+					frame.circuit = config->circuit[nAddr];
+					configExit();
+					newState = ctx.action;
+					result->reply = frame.on ? protocol->onReply : protocol->offReply;
+					break;
+				}
+				//STATUS
+				case 2:{
+					result->reply = '0' + stateGet(nAddr);
+					break;
+				}
+				default:{
+					LOG_W("command[%i] is unsupported", ctx.action);
+					result->addr = -1;
+					break;
+				}
+			}
+		}
+	}
+	if (newState >= 0 && result->status == RESULT_OK) {
+		frame.lane = lane;
+		frame.stagger = stagger * 1000L;
+		result->retryAfter = txSubmit(&frame, result->addr, newState, source, client);
+		if (result->retryAfter > 0) {
+			LOG_D("busy, retry after %d ms", result->retryAfter);
+			result->status = RESULT_BUSY;
+		}
+	}
+	if (result->status == RESULT_RANGE) {
+		result->reply = '2';
+		statsCount(STAT_OUT_OF_RANGE);
+	}
+	else if (result->status == RESULT_BUSY) {
+		result->reply = 'B';
+	}
+	else if (result->addr >= 0) {
+		statsCommand(ctx.sys, ctx.action);
+		result->sys = ctx.sys;
+		result->state = stateGet(result->addr);
+	}
+	else {
+		result->status = RESULT_INVALID;
+	}
+	if (result->status == RESULT_INVALID) {
+		statsCount(STAT_PARSE_ERRORS);
+	}
+}
+
+void printUsage() {
+	printf("Usage: rf433-daemon [options]\n\n");
+	printf("Options:\n\n");
+	printf(" -p PORT, --port=PORT\n");
+	printf("   TCP port to listen on, 0 disables the TCP listener. Default: 11337\n\n");
+	printf(" -s PATH, --socket=PATH\n");
+	printf("   Additionally listen on a unix domain socket at PATH. Local clients\n");
+	printf("   (web interface, scripts) connect faster there than over TCP.\n\n");
+	printf(" -b PATH, --bulk-socket=PATH\n");
+	printf("   Unix socket for scenes and scheduled jobs: its switch commands queue\n");
+	printf("   in the bulk lane, behind interactive ones from the other listeners.\n\n");
+	printf(" -m MODE, --socket-mode=MODE\n");
+	printf("   Permissions of the unix socket in octal. Default: 0660\n\n");
+	printf(" -H PORT, --http=PORT\n");
+	printf("   Serve the HTTP/JSON interface on PORT (keep-alive):\n");
+	printf("     GET  /states   all known plug states\n");
+	printf("     POST /command  one or more commands, e.g. 100001161\n\n");
+	printf(" -M, --metrics\n");
+	printf("   Also serve metrics in Prometheus text format on /metrics of the\n");
+	printf("   HTTP interface. The \"stats\" command works without this option.\n\n");
+	printf(" -v LEVEL, --log-level=LEVEL\n");
+	printf("   error, warn, info or debug (or 0-3). Default: info\n");
+	printf("   Can be changed at run time with the \"loglevel LEVEL\" command.\n\n");
+	printf(" -r RATE[:BURST], --rate=RATE[:BURST]\n");
+	printf("   Switch commands per second and client (IP address or uid of a unix\n");
+	printf("   socket peer), up to BURST at once. Status queries are not limited.\n");
+	printf("   0 disables the limit. Default: 2:20\n\n");
+	printf(" -a MS, --airtime-budget=MS\n");
+	printf("   Most airtime the transmit queue may hold. Commands over a limit are\n");
+	printf("   answered with busy and the ms after which to retry. Default: 10000\n\n");
+	printf(" -D PERCENT[:SECONDS], --duty-cycle=PERCENT[:SECONDS]\n");
+	printf("   Share of the sliding window the transmitter may be on air. Above it\n");
+	printf("   low priority frames (repeating a known state) wait, frames changing\n");
+	printf("   a plug still go. 0 only reports the utilization. Default: 0:600\n\n");
+	printf(" -w N, --workers=N\n");
+	printf("   Threads parsing and answering requests. Default: one per core\n\n");
+	printf(" -x SECONDS, --idle-exit=SECONDS\n");
+	printf("   Exit when no client was connected for SECONDS, for daemons started\n");
+	printf("   on demand by a supervisor (see rf433-launch). Default: run forever\n\n");
+	printf(" -J PATH[:KB], --journal=PATH[:KB]\n");
+	printf("   Journal every accepted command and every frame sent to PATH, and\n");
+	printf("   start with the plug states it holds. Rotated at KB (default 1024),\n");
+	printf("   rf433-journal-dump reads it.\n\n");
+	printf(" -c PATH, --config=PATH\n");
+	printf("   Devices, profiles (pulse lengths) and scenes. Loaded again on SIGHUP\n");
+	printf("   or the \"reload\" command, commands in flight keep the old tables.\n\n");
+	printf(" -C PATH, --capture=PATH\n");
+	printf("   Record every command with its time and client to PATH, a compact\n");
+	printf("   binary log bench/replay plays back against a test daemon.\n\n");
+	printf(" -T PATH, --schedules=PATH\n");
+	printf("   Keep the recurring schedules (\"schedule add ...\") in PATH, loaded\n");
+	printf("   at start and rewritten on every change.\n\n");
+	printf(" -S PATH, --history=PATH\n");
+	printf("   Keep the state history of the plugs, queried with \"history\", in\n");
+	printf("   PATH instead of memory so it survives restarts.\n\n");
+	printf(" -h, --help:\n");
+	printf("   displays this help\n\n");
+	printf("Listening sockets passed in LISTEN_FDS/LISTEN_PID/LISTEN_FDNAMES are\n");
+	printf("used as well, the TCP port is then only opened if -p is given.\n\n");
+}
+
+/**
+ * take over the listening sockets of a supervisor (systemd style socket
+ * activation), descriptors 3 to 3 + LISTEN_FDS - 1, the ones named
+ * "http" in LISTEN_FDNAMES serve HTTP, "bulk" queues in the bulk lane
+ * returns the number of sockets
+ */
+int inheritListeners() {
+	const char* pid = getenv("LISTEN_PID");
+	const char* count = getenv("LISTEN_FDS");
+	if (count == NULL || (pid != NULL && atoi(pid) != getpid())) {
+		return 0;
 	}
-	else if (nAction == 1) { //ON
-		switchnr |= 0b01010100000011;
+	int n = atoi(count);
+	const char* names = getenv("LISTEN_FDNAMES");
+	for (int i = 0; i < n; i++) {
+		int fd = 3 + i;
+		int kind = CONN_RAW;
+		int lane = TX_LANE_INTERACTIVE;
+		if (names != NULL) {
+			int len = strcspn(names, ":");
+			if (len == 4 && strncmp(names, "http", 4) == 0) {
+				kind = CONN_HTTP;
+			}
+			if (len == 4 && strncmp(names, "bulk", 4) == 0) {
+				lane = TX_LANE_BULK;
+			}
+			names = names[len] == ':' ? names + len + 1 : names + len;
+		}
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+		addListener(fd, kind, lane);
 	}
-	//switchnr |= 0b11 << (2*(nSwitchNumber+1));
-	//int result = (group << 14) | switchnr;
-	return (group << 14) | switchnr;
+	unsetenv("LISTEN_PID");
+	unsetenv("LISTEN_FDS");
+	unsetenv("LISTEN_FDNAMES");
+	return n;
 }
 
 /**
- * convert int to 5 bit binary (string)
- * https://stackoverflow.com/questions/7911651/decimal-to-binary
- * modified as function which returns string
- *   char* getBin(int num)
- * void getBin(int num, char *str)
+ * open the TCP listener on all interfaces
  */
-void getBin(int num, char *str)
-{
-  //char *str
-  *(str+5) = '\0';
-  int mask = 0x10 << 1;
-  while(mask >>= 1)
-    *str++ = !!(mask & num) + '0';
+int openTcpListener(int port) {
+	struct sockaddr_in serv_addr;
+	int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+	if (sockfd < 0) {
+		error("ERROR opening socket");
+	}
+	int on = 1;
+	setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	bzero((char *) &serv_addr, sizeof(serv_addr));
+	serv_addr.sin_family = AF_INET;
+	serv_addr.sin_addr.s_addr = INADDR_ANY;
+	serv_addr.sin_port = htons(port);
+	if (bind(sockfd, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0) {
+		error("ERROR on binding");
+	}
+	if (listen(sockfd, SOMAXCONN) < 0) {
+		error("ERROR on listen");
+	}
+	return sockfd;
 }
 
-PI_THREAD(switchOn) {
-	printf("switchOnThread: %d\n", nTimeout);
-	char tGroup[6];
-	char tSwitchNumber[6];
-	memcpy(tGroup, nGroup, sizeof(tGroup));
-	getBin(nSwitchNumber,tSwitchNumber);
-	sleep(nTimeout*60);
-	mySwitch.switchOn(tGroup, tSwitchNumber);
-	return 0;
+/**
+ * open the unix domain socket listener
+ * a stale socket file from a previous run is replaced
+ */
+int openUnixListener(const char* path, int mode) {
+	struct sockaddr_un serv_addr;
+	if (strlen(path) >= sizeof(serv_addr.sun_path)) {
+		printf("socket path too long: %s\n", path);
+		exit(1);
+	}
+	int sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sockfd < 0) {
+		error("ERROR opening unix socket");
+	}
+	bzero((char *) &serv_addr, sizeof(serv_addr));
+	serv_addr.sun_family = AF_UNIX;
+	strcpy(serv_addr.sun_path, path);
+	unlink(path);
+	if (bind(sockfd, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0) {
+		error("ERROR on binding unix socket");
+	}
+	if (chmod(path, mode) < 0) {
+		error("ERROR on chmod of unix socket");
+	}
+	if (listen(sockfd, SOMAXCONN) < 0) {
+		error("ERROR on listen");
+	}
+	return sockfd;
 }
 
-PI_THREAD(switchOff) {
-	printf("switchOffThread: %d\n", nTimeout);
-	char tGroup[6];
-	char tSwitchNumber[6];
-	memcpy(tGroup, nGroup, sizeof(tGroup));
-	getBin(nSwitchNumber,tSwitchNumber);
-	sleep(nTimeout*60);
-	mySwitch.switchOff(tGroup, tSwitchNumber);
-	return 0;
+/**
+ * error output
+ */
+void error(const char *msg) {
+	perror(msg);
+	exit(1);
 }
+
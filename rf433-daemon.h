@@ -1,20 +1,58 @@
 #include <wiringPi.h>
+#include <atomic>
 
-char nGroup[6];
-int nSys;
-int nSwitchNumber;
-char nSwitch[6];
-int nAction;
-int nPlugs;
-int nTimeout;
-int PORT = 11337;
+#include "rf433-protocol.h"
+#include "rf433-state.h"
+
+extern int nPlugs;
+extern int PORT;
+extern bool httpMetrics;
+
+#define RESULT_BUSY 3
+
+struct CommandResult {
+	int sys;
+	int addr;
+	int state;
+	int status;
+	char reply;	// legacy one byte reply, 0 for none
+	int retryAfter;	// ms, when busy
+};
+
+#define CONN_RAW 0
+#define CONN_HTTP 1
+#define CONN_SUBSCRIBER 2
+#define CONN_PIPELINE 3
+#define MAX_LISTENERS 4
+#define MAX_CONNECTIONS 1024
+#define MAX_WORKERS 16
+
+struct HttpBuffers;
+
+struct Connection {
+	int fd;
+	int kind;
+	const char* out;	// pending output
+	int outPos;
+	int outLen;
+	bool closeAfterWrite;
+	long readyAt;	// monotonic us when the last request was read
+	unsigned long client;	// peer for the rate limit, see peerKey()
+	int lane;	// transmit lane of its commands, see rf433-tx.h
+	int stagger;	// ms between on frames of a circuit, "pipeline stagger=MS"
+	char reply[16];
+	HttpBuffers* http;	// allocated on first use, kept for the slot,
+				// also used for longer raw replies
+	unsigned long eventCursor;	// next event for subscribers
+	int eventOffset;
+	bool eventBlocked;
+};
 
 void error(const char *msg);
-void getBin(int num, char *str);
-int getAddrElro(const char* nGroup, int nSwitchNumber);
-int getAddrInt(const char* nGroup, int nSwitchNumber);
-// add code for Zap/REV switches
-int getDecimalZap(const char* nGroup, int nSwitchNumber, int nAction);
-
-PI_THREAD(switchOn);
-PI_THREAD(switchOff);
+void printUsage();
+int openTcpListener(int port);
+int openUnixListener(const char* path, int mode);
+void handleMessage(const char* buffer, int source, int lane, unsigned long client, CommandResult* result, int stagger = 0);
+void closeConnection(Connection* conn);
+void sendConnection(Connection* conn, const char* data, int len);
+
@@ -0,0 +1,161 @@
+/**
+ * state change events of the RCSwitch daemon
+ *
+ * Every change of a plug state is rendered once into a line of a shared
+ * ring. Subscribers only keep a cursor into the ring, their sockets are
+ * written with writev() straight from the ring slots, so the cost of an
+ * event does not grow with the number of subscribers.
+ *
+ * Events may be published from any thread, in the order of the changes
+ * when the publisher holds the lock that orders them. eventsWake() then
+ * wakes the poll loop of every worker with subscribers through its own
+ * pipe to flush them, outside of that lock; without subscribers an
+ * event costs no system call.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <atomic>
+
+#include "rf433-daemon.h"
+#include "rf433-events.h"
+
+struct EventSlot {
+	char line[EVENT_LINE_SIZE];
+	int len;
+};
+
+static EventSlot ring[EVENT_RING_SIZE];
+static std::atomic<unsigned long> head(0);
+static pthread_mutex_t publishLock = PTHREAD_MUTEX_INITIALIZER;
+static int wakePipes[MAX_WORKERS][2];
+static int nWakePipes = 0;
+static std::atomic<int> subscribers[MAX_WORKERS];
+
+static const char sourceNames[] = { 'n', 't', 'r' };
+
+void eventsInit(int workers) {
+	for (int i = 0; i < workers; i++) {
+		if (pipe(wakePipes[i]) < 0) {
+			error("ERROR creating event pipe");
+		}
+		fcntl(wakePipes[i][0], F_SETFL, O_NONBLOCK);
+		fcntl(wakePipes[i][1], F_SETFL, O_NONBLOCK);
+	}
+	nWakePipes = workers;
+}
+
+int eventsWakeFd(int worker) {
+	return wakePipes[worker][0];
+}
+
+/**
+ * count a subscriber of the worker, returns the cursor it starts at
+ */
+unsigned long eventsSubscribe(int worker) {
+	// counted before head is read: an event published meanwhile is
+	// either behind the cursor or its publisher sees the subscriber
+	subscribers[worker].fetch_add(1, std::memory_order_seq_cst);
+	return head.load(std::memory_order_seq_cst);
+}
+
+void eventsUnsubscribe(int worker) {
+	subscribers[worker].fetch_sub(1, std::memory_order_relaxed);
+}
+
+void eventsDrainWake(int worker) {
+	char buffer[64];
+	while (read(wakePipes[worker][0], buffer, sizeof(buffer)) > 0) {
+	}
+}
+
+void publishEvent(int addr, int state, int source) {
+	char key[16];
+	if (protocolKey(addr, key) == 0) {
+		return;
+	}
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	long long ms = (long long) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+
+	pthread_mutex_lock(&publishLock);
+	unsigned long seq = head.load(std::memory_order_relaxed);
+	EventSlot* slot = &ring[seq & (EVENT_RING_SIZE - 1)];
+	slot->len = snprintf(slot->line, EVENT_LINE_SIZE, "%s %d %c %lld\n", key, state, sourceNames[source], ms);
+	head.store(seq + 1, std::memory_order_seq_cst);
+	pthread_mutex_unlock(&publishLock);
+}
+
+/**
+ * let the workers with subscribers flush what was published
+ */
+void eventsWake() {
+	for (int i = 0; i < nWakePipes; i++) {
+		if (subscribers[i].load(std::memory_order_seq_cst) > 0) {
+			// a full pipe already guarantees a wake up
+			write(wakePipes[i][1], "e", 1);
+		}
+	}
+}
+
+unsigned long eventsHead() {
+	return head.load(std::memory_order_acquire);
+}
+
+/**
+ * write the events from cursor to head into fd
+ * returns 0 when the subscriber caught up, 1 if the socket is full
+ * and -1 on errors or if the ring overran the subscriber
+ */
+int eventsWrite(int fd, unsigned long* cursor, int* offset) {
+	struct iovec iov[64];
+	while (true) {
+		unsigned long end = eventsHead();
+		if (*cursor == end) {
+			return 0;
+		}
+		if (end - *cursor > EVENT_RING_SIZE) {
+			return -1;
+		}
+		int count = 0;
+		size_t total = 0;
+		for (unsigned long seq = *cursor; seq != end && count < 64; seq++) {
+			EventSlot* slot = &ring[seq & (EVENT_RING_SIZE - 1)];
+			int skip = count == 0 ? *offset : 0;
+			iov[count].iov_base = slot->line + skip;
+			iov[count].iov_len = slot->len - skip;
+			total += iov[count].iov_len;
+			count++;
+		}
+		ssize_t n = writev(fd, iov, count);
+		// the slots may have been reused while we were writing
+		if (eventsHead() - *cursor > EVENT_RING_SIZE) {
+			return -1;
+		}
+		if (n < 0) {
+			return errno == EAGAIN || errno == EWOULDBLOCK ? 1 : -1;
+		}
+		size_t written = n;
+		for (int i = 0; i < count && n > 0; i++) {
+			if ((size_t) n >= iov[i].iov_len) {
+				n -= iov[i].iov_len;
+				(*cursor)++;
+				*offset = 0;
+			}
+			else {
+				*offset += n;
+				n = 0;
+			}
+		}
+		if (written < total) {
+			// partial write, the socket is full
+			return 1;
+		}
+	}
+}
@@ -0,0 +1,21 @@
+/**
+ * state change events of the RCSwitch daemon
+ */
+
+#define EVENT_SOURCE_NETWORK 0
+#define EVENT_SOURCE_TIMER 1
+#define EVENT_SOURCE_RECEIVER 2
+
+// power of two, a subscriber further behind than this is dropped
+#define EVENT_RING_SIZE 1024
+#define EVENT_LINE_SIZE 40
+
+void eventsInit(int workers);
+int eventsWakeFd(int worker);
+void eventsDrainWake(int worker);
+unsigned long eventsSubscribe(int worker);
+void eventsUnsubscribe(int worker);
+void publishEvent(int addr, int state, int source);
+void eventsWake();
+unsigned long eventsHead();
+int eventsWrite(int fd, unsigned long* cursor, int* offset);
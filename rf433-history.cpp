@@ -0,0 +1,257 @@
+/**
+ * per plug state history of the RCSwitch daemon
+ *
+ * Every state change of a plug is appended to its own small ring of
+ * fixed size segments (rf433-history.h): a segment holds the time and
+ * state of its first transition and the seconds between the following
+ * ones as varints with the new state in their low bit, so a segment
+ * keeps 20 to 50 transitions and a plug
+ * costs 264 bytes whether it is used or not. The oldest segment is
+ * reused when the ring is full. Every transition stores its state, the
+ * table outlives a restart that forgot the plug states, and a command
+ * then repeating the last recorded state is not taken for a change.
+ *
+ * With --history=PATH the table is a memory mapped file and survives
+ * restarts, otherwise it lives in anonymous memory. Changes are recorded
+ * by the transmit queue under its lock, queries read a plug through a
+ * sequence lock and never block it:
+ *
+ *   history KEY|all [FROM [TO]]
+ *     10000116 on=3600 transitions=4 state=1
+ *   seconds the plug was on and its transitions between FROM and TO,
+ *   seconds since the epoch or, when negative, before now; default is
+ *   today since local midnight. "all" lists every plug with a history.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <atomic>
+
+#include "rf433-daemon.h"
+#include "rf433-history.h"
+
+static HistoryPlug* plugs = NULL;
+// odd while the plug is written
+static std::atomic<unsigned>* versions = NULL;
+
+struct HistorySummary {
+	long on;	// seconds
+	int transitions;
+	int state;	// at the end of the range, -1 if unknown
+};
+
+/**
+ * map the history table, from PATH when given so it outlives the daemon
+ */
+bool historyInit(const char* path) {
+	size_t size = sizeof(HistoryHeader) + sizeof(HistoryPlug) * nPlugs;
+	void* table;
+	if (path == NULL) {
+		table = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	}
+	else {
+		int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0640);
+		if (fd < 0 || ftruncate(fd, size) < 0) {
+			return false;
+		}
+		table = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+	}
+	if (table == MAP_FAILED) {
+		return false;
+	}
+	HistoryHeader* header = (HistoryHeader*) table;
+	if (header->magic != HISTORY_MAGIC || header->plugs != (unsigned) nPlugs
+			|| header->segments != HISTORY_SEGMENTS || header->segmentSize != HISTORY_SEGMENT_SIZE) {
+		// new, or of a build with another layout
+		memset(table, 0, size);
+		header->magic = HISTORY_MAGIC;
+		header->plugs = nPlugs;
+		header->segments = HISTORY_SEGMENTS;
+		header->segmentSize = HISTORY_SEGMENT_SIZE;
+	}
+	plugs = (HistoryPlug*) (header + 1);
+	versions = new std::atomic<unsigned>[nPlugs]();
+	return true;
+}
+
+static unsigned int nowSeconds() {
+	return (unsigned int) time(NULL);
+}
+
+/**
+ * append a state change, the caller serializes the writers
+ */
+void historyRecord(int addr, int state) {
+	if (plugs == NULL) {
+		return;
+	}
+	unsigned int now = nowSeconds();
+	HistoryPlug* plug = &plugs[addr];
+	versions[addr].fetch_add(1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	HistorySegment* segment = plug->written > 0 ? &plug->segments[(plug->written - 1) % HISTORY_SEGMENTS] : NULL;
+	if (segment != NULL && segment->newest == state) {
+		// the state was not known since a restart, it did not change
+		versions[addr].fetch_add(1, std::memory_order_release);
+		return;
+	}
+	// a varint of 33 bits takes up to 5 bytes
+	if (segment == NULL || segment->used + 5 > (int) sizeof(segment->deltas) || segment->count == 255) {
+		segment = &plug->segments[plug->written % HISTORY_SEGMENTS];
+		segment->start = now;
+		segment->last = now;
+		segment->state = state;
+		segment->newest = state;
+		segment->count = 1;
+		segment->used = 0;
+		plug->written++;
+	}
+	else {
+		unsigned long value = (unsigned long) (now > segment->last ? now - segment->last : 0) << 1 | (state & 1);
+		while (value >= 0x80) {
+			segment->deltas[segment->used++] = (value & 0x7f) | 0x80;
+			value >>= 7;
+		}
+		segment->deltas[segment->used++] = value;
+		segment->last = now > segment->last ? now : segment->last;
+		segment->newest = state;
+		segment->count++;
+	}
+	versions[addr].fetch_add(1, std::memory_order_release);
+}
+
+/**
+ * consistent copy of a plug while the transmit queue may write it
+ */
+static void readPlug(int addr, HistoryPlug* copy) {
+	while (true) {
+		unsigned version = versions[addr].load(std::memory_order_acquire);
+		if (version & 1) {
+			continue;
+		}
+		memcpy(copy, &plugs[addr], sizeof(HistoryPlug));
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (versions[addr].load(std::memory_order_relaxed) == version) {
+			return;
+		}
+	}
+}
+
+static void summarize(const HistoryPlug* plug, long from, long to, HistorySummary* summary) {
+	summary->on = 0;
+	summary->transitions = 0;
+	summary->state = -1;
+	long at = from;
+	unsigned int first = plug->written > HISTORY_SEGMENTS ? plug->written - HISTORY_SEGMENTS : 0;
+	for (unsigned int i = first; i < plug->written; i++) {
+		const HistorySegment* segment = &plug->segments[i % HISTORY_SEGMENTS];
+		long t = segment->start;
+		int state = segment->state;
+		int pos = 0;
+		for (int n = 0; n < segment->count; n++) {
+			if (n > 0) {
+				unsigned long value = 0;
+				for (int shift = 0; pos < segment->used; shift += 7) {
+					unsigned char b = segment->deltas[pos++];
+					value |= (unsigned long) (b & 0x7f) << shift;
+					if ((b & 0x80) == 0) {
+						break;
+					}
+				}
+				t += value >> 1;
+				state = value & 1;
+			}
+			if (t > to) {
+				break;
+			}
+			if (t > from && state == summary->state) {
+				// no change, e.g. across segments of different runs
+				continue;
+			}
+			if (t > from) {
+				// the state before the oldest transition kept is its opposite
+				if (summary->state < 0) {
+					summary->state = !state;
+				}
+				if (summary->state == 1) {
+					summary->on += t - at;
+				}
+				at = t;
+				summary->transitions++;
+			}
+			summary->state = state;
+		}
+	}
+	if (summary->state == 1) {
+		summary->on += to - at;
+	}
+}
+
+static long localMidnight(long now) {
+	time_t t = now;
+	struct tm day;
+	localtime_r(&t, &day);
+	day.tm_hour = 0;
+	day.tm_min = 0;
+	day.tm_sec = 0;
+	return mktime(&day);
+}
+
+static int format(int addr, const HistorySummary* summary, char* buffer, int size) {
+	char key[16];
+	protocolKey(addr, key);
+	int len = snprintf(buffer, size, "%s on=%ld transitions=%d state=%d\n", key, summary->on, summary->transitions,
+		summary->state >= 0 ? summary->state : stateGet(addr));
+	return len < size ? len : 0;
+}
+
+/**
+ * answer of "history KEY|all [FROM [TO]]"
+ */
+int historyQuery(const char* args, char* buffer, int size) {
+	char which[16];
+	long from = 0;
+	long to = 0;
+	int n = sscanf(args, "%15s %ld %ld", which, &from, &to);
+	if (n < 1 || plugs == NULL) {
+		return snprintf(buffer, size, "E invalid\n");
+	}
+	long now = nowSeconds();
+	from = n < 2 ? localMidnight(now) : from < 0 ? now + from : from;
+	to = n < 3 ? now : to < 0 ? now + to : to;
+	if (to > now) {
+		to = now;
+	}
+
+	HistoryPlug plug;
+	HistorySummary summary;
+	if (strcmp(which, "all") != 0) {
+		int addr = protocolAddress(which);
+		if (addr < 0) {
+			return snprintf(buffer, size, "E range\n");
+		}
+		readPlug(addr, &plug);
+		summarize(&plug, from, to, &summary);
+		return format(addr, &summary, buffer, size);
+	}
+	int len = 0;
+	for (int addr = 0; addr < nPlugs; addr++) {
+		if (plugs[addr].written == 0) {
+			continue;
+		}
+		readPlug(addr, &plug);
+		summarize(&plug, from, to, &summary);
+		int added = format(addr, &summary, buffer + len, size - len);
+		if (added == 0) {
+			break;
+		}
+		len += added;
+	}
+	return len;
+}
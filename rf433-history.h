@@ -0,0 +1,40 @@
+/**
+ * per plug state history of the RCSwitch daemon
+ */
+
+// ring of segments per plug, the oldest segment is overwritten
+#define HISTORY_SEGMENTS 4
+#define HISTORY_SEGMENT_SIZE 64
+#define HISTORY_MAGIC 0x53333452	// "R43S", transitions carry their state
+
+/**
+ * transitions of one plug, the first with its full time and state, the
+ * ones after it as varints of the seconds since the previous one shifted
+ * left by one, the new state in the low bit
+ */
+struct HistorySegment {
+	unsigned int start;	// seconds since the epoch
+	unsigned int last;	// of the newest transition in the segment
+	unsigned char state;	// after the first transition
+	unsigned char count;
+	unsigned short used;	// bytes of deltas
+	unsigned char newest;	// state after the newest transition
+	unsigned char deltas[HISTORY_SEGMENT_SIZE - 13];
+};
+
+struct HistoryPlug {
+	unsigned int written;	// segments ever started, the newest is written - 1
+	unsigned int reserved;
+	HistorySegment segments[HISTORY_SEGMENTS];
+};
+
+struct HistoryHeader {
+	unsigned int magic;
+	unsigned int plugs;
+	unsigned int segments;
+	unsigned int segmentSize;
+};
+
+bool historyInit(const char* path);
+void historyRecord(int addr, int state);
+int historyQuery(const char* args, char* buffer, int size);
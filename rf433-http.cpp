@@ -0,0 +1,435 @@
+/**
+ * HTTP/JSON interface of the RCSwitch daemon
+ *
+ * A minimal HTTP/1.1 server on top of the daemon's poll loop, so
+ * dashboards get the whole plug table with one request instead of one
+ * raw connection per plug. Connections are kept alive and pipelined
+ * requests are answered in order.
+ *
+ *   GET  /states
+ *     {"states":{"10000116":1,"20102":0}}
+ *     keys are the command prefixes (system, group, switch) of every
+ *     plug that was switched since the daemon started
+ *     GET /states?meta=1 adds when and by what (n, t, r) it was last
+ *     changed and the state of a frame still queued for it, -1 for none
+ *       {"states":{"10000116":{"state":1,"changed":1760853922,"source":"n","pending":-1}}}
+ *     a table larger than the body buffer (meta of more than about 850
+ *     plugs) is sent in parts with Transfer-Encoding: chunked, to
+ *     HTTP/1.0 clients until the connection closes
+ *     GET /states?format=bitmap is the whole table as two bitmaps, see
+ *     rf433-state.cpp
+ *       {"plugs":2304,"known":2,"on":1,"on_bits":"0000...","known_bits":"0000..."}
+ *
+ *   POST /command
+ *     body: one or more commands, separated by whitespace or commas,
+ *     a JSON array of strings works as well
+ *       curl -d '["100001161","202021"]' localhost:8080/command
+ *     {"results":[{"command":"100001161","key":"10000116","state":1},...]}
+ *     a command over the rate or airtime limit is not sent:
+ *     {"command":"100001161","error":"busy","retry_after_ms":1250}
+ *     commands whose results would not fit into the response are not
+ *     executed, only counted: {"results":[...],"not_executed":12}
+ *     POST /command?trace=1 adds the trace of every command, stages in us
+ *     after the request was read
+ *     POST /command?lane=bulk queues the commands behind interactive ones,
+ *     for scenes and restoring many plugs
+ *     POST /command?stagger=MS switches plugs of one circuit on at least
+ *     MS apart, see rf433-tx.cpp
+ *
+ *   GET  /metrics
+ *     Prometheus text format, only with --metrics
+ *
+ * Responses are rendered into buffers owned by the connection slot,
+ * which are allocated once and reused for every request after that.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <errno.h>
+#include <ctype.h>
+
+#include "rf433-daemon.h"
+#include "rf433-http.h"
+#include "rf433-events.h"
+#include "rf433-stats.h"
+#include "rf433-trace.h"
+#include "rf433-tx.h"
+
+static void append(HttpBuffers* http, const char* fmt, ...) {
+	int room = HTTP_BODY_SIZE - http->bodyLen;
+	if (http->overflow) {
+		return;
+	}
+	va_list args;
+	va_start(args, fmt);
+	int n = vsnprintf(http->out + HTTP_HEAD_SIZE + http->bodyLen, room, fmt, args);
+	va_end(args);
+	if (n >= room) {
+		// a cut JSON body is worse than none
+		http->overflow = true;
+	}
+	else if (n > 0) {
+		http->bodyLen += n;
+	}
+}
+
+/**
+ * put the header in front of the rendered body and send both at once,
+ * a body that did not fit is replaced by an error
+ */
+static void respond(Connection* conn, int status, const char* reason, bool keepAlive, const char* type = "application/json") {
+	HttpBuffers* http = conn->http;
+	if (http->overflow) {
+		http->bodyLen = 0;
+		http->overflow = false;
+		status = 507;
+		reason = "Insufficient Storage";
+		type = "application/json";
+		append(http, "{\"error\":\"%s\"}", reason);
+	}
+	char head[HTTP_HEAD_SIZE];
+	int headLen = snprintf(head, sizeof(head),
+		"HTTP/1.1 %d %s\r\n"
+		"Content-Type: %s\r\n"
+		"Content-Length: %d\r\n"
+		"Connection: %s\r\n"
+		"\r\n",
+		status, reason, type, http->bodyLen, keepAlive ? "keep-alive" : "close");
+	char* start = http->out + HTTP_HEAD_SIZE - headLen;
+	memcpy(start, head, headLen);
+	conn->closeAfterWrite = !keepAlive;
+	sendConnection(conn, start, headLen + http->bodyLen);
+}
+
+static void respondError(Connection* conn, int status, const char* reason, bool keepAlive) {
+	conn->http->bodyLen = 0;
+	conn->http->overflow = false;
+	append(conn->http, "{\"error\":\"%s\"}", reason);
+	respond(conn, status, reason, keepAlive);
+}
+
+/**
+ * render the known plugs of the snapshot from addr on, as many as fit;
+ * returns the plug to continue with, -1 when the table is complete
+ */
+static int renderStates(HttpBuffers* http, bool meta, int from) {
+	char key[16];
+	// only the plugs that were set, 64 at a time
+	for (int w = from / STATE_WORD_BITS; w < stateWords; w++) {
+		unsigned long long bits = http->known[w];
+		if (w == from / STATE_WORD_BITS) {
+			bits &= ~0ULL << (from % STATE_WORD_BITS);
+		}
+		for (; bits != 0; bits &= bits - 1) {
+			int addr = w * STATE_WORD_BITS + __builtin_ctzll(bits);
+			if (HTTP_BODY_SIZE - http->bodyLen < HTTP_STATE_SIZE) {
+				return addr;
+			}
+			if (protocolKey(addr, key) == 0) {
+				continue;
+			}
+			int state = (http->on[w] >> (addr % STATE_WORD_BITS)) & 1;
+			if (meta) {
+				int pending = plugMeta[addr].pending.load(std::memory_order_relaxed);
+				append(http, "%s\"%s\":{\"state\":%d,\"changed\":%u,\"source\":\"%c\",\"pending\":%d}", http->streamFirst ? "" : ",", key, state,
+					plugMeta[addr].changed.load(std::memory_order_relaxed), "ntr?"[plugMeta[addr].source.load(std::memory_order_relaxed) & 3],
+					pending == STATE_PENDING_NONE ? -1 : pending);
+			}
+			else {
+				append(http, "%s\"%s\":%d", http->streamFirst ? "" : ",", key, state);
+			}
+			http->streamFirst = false;
+		}
+	}
+	append(http, "}}");
+	return -1;
+}
+
+/**
+ * send the rendered part of a streamed table, the first with the header
+ * in front, the last followed by the end of the chunks
+ */
+static void sendStates(Connection* conn, bool first) {
+	HttpBuffers* http = conn->http;
+	bool last = http->streamAddr < 0;
+	char* body = http->out + HTTP_HEAD_SIZE;
+	int len = http->bodyLen;
+	if (http->streamChunked) {
+		len += sprintf(body + len, last ? "\r\n0\r\n\r\n" : "\r\n");
+	}
+	char head[HTTP_HEAD_SIZE];
+	int headLen = 0;
+	if (first) {
+		headLen = snprintf(head, sizeof(head),
+			"HTTP/1.1 200 OK\r\n"
+			"Content-Type: application/json\r\n"
+			"%s"
+			"Connection: %s\r\n"
+			"\r\n",
+			http->streamChunked ? "Transfer-Encoding: chunked\r\n" : "", http->streamClose ? "close" : "keep-alive");
+	}
+	if (http->streamChunked) {
+		headLen += snprintf(head + headLen, sizeof(head) - headLen, "%x\r\n", http->bodyLen);
+	}
+	char* start = body - headLen;
+	memcpy(start, head, headLen);
+	conn->closeAfterWrite = last && http->streamClose;
+	sendConnection(conn, start, headLen + len);
+}
+
+/**
+ * the known plugs, in one response when they fit, else streamed from a
+ * snapshot of the table as the client reads them
+ */
+static void getStates(Connection* conn, bool meta, bool keepAlive, bool chunked) {
+	HttpBuffers* http = conn->http;
+	stateSnapshot(http->on, http->known);
+	http->streamFirst = true;
+	append(http, "{\"states\":{");
+	int next = renderStates(http, meta, 0);
+	if (next < 0) {
+		respond(conn, 200, "OK", keepAlive);
+		return;
+	}
+	http->streamAddr = next;
+	http->streamMeta = meta;
+	http->streamChunked = chunked;
+	http->streamClose = !keepAlive || !chunked;
+	sendStates(conn, true);
+}
+
+/**
+ * the next part of a streamed table, once the previous one was written
+ */
+static void continueStates(Connection* conn) {
+	HttpBuffers* http = conn->http;
+	http->bodyLen = 0;
+	http->streamAddr = renderStates(http, http->streamMeta, http->streamAddr);
+	sendStates(conn, false);
+}
+
+static void getBitmap(HttpBuffers* http) {
+	unsigned long long on[STATE_MAX_WORDS];
+	unsigned long long known[STATE_MAX_WORDS];
+	stateSnapshot(on, known);
+	char hex[STATE_MAX_WORDS * 16 + 1];
+	int size = sizeof(hex);
+	append(http, "{\"plugs\":%d,\"known\":%d,\"on\":%d", nPlugs, stateCount(known, 0, nPlugs), stateCount(on, 0, nPlugs));
+	stateHex(on, hex, size);
+	append(http, ",\"on_bits\":\"%s\"", hex);
+	stateHex(known, hex, size);
+	append(http, ",\"known_bits\":\"%s\"}", hex);
+}
+
+static void postCommand(Connection* conn, char* body, int bodyLen, bool traced, int lane, int stagger) {
+	HttpBuffers* http = conn->http;
+	char command[32];
+	CommandResult result;
+	bool first = true;
+	int skipped = 0;
+	append(http, "{\"results\":[");
+	int i = 0;
+	while (i < bodyLen) {
+		if (!isalnum((unsigned char) body[i])) {
+			i++;
+			continue;
+		}
+		int len = 0;
+		while (i < bodyLen && isalnum((unsigned char) body[i])) {
+			if (len < (int) sizeof(command) - 1) {
+				command[len++] = body[i];
+			}
+			i++;
+		}
+		command[len] = '\0';
+		// skips JSON keys like {"commands":[...]}
+		if (!isdigit((unsigned char) command[0])) {
+			continue;
+		}
+		// a command is only executed when its result can be reported
+		if (HTTP_BODY_SIZE - http->bodyLen < HTTP_RESULT_SIZE) {
+			skipped++;
+			continue;
+		}
+		TraceRecord* trace = traceBegin(conn->readyAt, command);
+		handleMessage(command, EVENT_SOURCE_NETWORK, lane, conn->client, &result, stagger);
+		traceEnd(trace, result.addr, result.status);
+		append(http, "%s{\"command\":\"%s\"", first ? "" : ",", command);
+		if (result.status == RESULT_OK) {
+			char key[16];
+			protocolKey(result.addr, key);
+			append(http, ",\"key\":\"%s\",\"state\":%d", key, result.state);
+		}
+		else if (result.status == RESULT_BUSY) {
+			append(http, ",\"error\":\"busy\",\"retry_after_ms\":%d", result.retryAfter);
+		}
+		else {
+			append(http, ",\"error\":\"%s\"", result.status == RESULT_RANGE ? "out of range" : "invalid");
+		}
+		if (traced) {
+			append(http, ",\"trace\":{\"id\":%lu,\"parse\":%ld,\"enqueue\":%ld,\"tx_start\":%ld,\"tx_end\":%ld}",
+				trace->id, trace->parse - trace->accept,
+				trace->enqueue ? trace->enqueue - trace->accept : -1,
+				trace->txStart ? trace->txStart - trace->accept : -1,
+				trace->txEnd ? trace->txEnd - trace->accept : -1);
+		}
+		append(http, "}");
+		first = false;
+	}
+	append(http, "]");
+	if (skipped > 0) {
+		append(http, ",\"not_executed\":%d", skipped);
+	}
+	append(http, "}");
+}
+
+void httpOpen(Connection* conn) {
+	if (conn->http == NULL) {
+		conn->http = (HttpBuffers*) malloc(sizeof(HttpBuffers));
+		if (conn->http == NULL) {
+			error("ERROR allocating HTTP buffers");
+		}
+	}
+	conn->http->inLen = 0;
+	conn->http->overflow = false;
+	conn->http->streamAddr = -1;
+}
+
+void httpRead(Connection* conn) {
+	HttpBuffers* http = conn->http;
+	int n = read(conn->fd, http->in + http->inLen, HTTP_IN_SIZE - http->inLen);
+	if (n <= 0) {
+		if (n < 0 && errno == EAGAIN) {
+			return;
+		}
+		closeConnection(conn);
+		return;
+	}
+	http->inLen += n;
+	conn->readyAt = statsNow();
+	httpProcess(conn);
+}
+
+/**
+ * answer the buffered requests, one at a time while nothing is pending
+ */
+void httpProcess(Connection* conn) {
+	HttpBuffers* http = conn->http;
+	static thread_local bool processing = false;
+	if (processing) {
+		// called back from sendConnection, the loop below continues
+		return;
+	}
+	processing = true;
+	while (conn->fd >= 0 && conn->outLen == 0 && (http->inLen > 0 || http->streamAddr >= 0)) {
+		// a streamed table goes on before the requests behind it
+		if (http->streamAddr >= 0) {
+			continueStates(conn);
+			continue;
+		}
+		http->in[http->inLen] = '\0';
+		char* end = strstr(http->in, "\r\n\r\n");
+		if (end == NULL) {
+			if (http->inLen == HTTP_IN_SIZE) {
+				respondError(conn, 413, "Request Entity Too Large", false);
+			}
+			break;
+		}
+		int headLen = end + 4 - http->in;
+
+		/*
+		* request line and the headers we care about
+		*/
+		char method[8];
+		char path[64];
+		int minor = 1;
+		if (sscanf(http->in, "%7s %63s HTTP/1.%d", method, path, &minor) < 2) {
+			respondError(conn, 400, "Bad Request", false);
+			break;
+		}
+		bool keepAlive = minor >= 1;
+		int contentLength = 0;
+		for (char* line = strstr(http->in, "\r\n"); line != NULL && line < end; line = strstr(line + 2, "\r\n")) {
+			char* value = line + 2;
+			if (strncasecmp(value, "Content-Length:", 15) == 0) {
+				contentLength = atoi(value + 15);
+			}
+			else if (strncasecmp(value, "Connection:", 11) == 0) {
+				value += 11;
+				while (*value == ' ') value++;
+				if (strncasecmp(value, "close", 5) == 0) keepAlive = false;
+				if (strncasecmp(value, "keep-alive", 10) == 0) keepAlive = true;
+			}
+		}
+		if (contentLength < 0 || headLen + contentLength > HTTP_IN_SIZE) {
+			respondError(conn, 413, "Request Entity Too Large", false);
+			break;
+		}
+		if (http->inLen < headLen + contentLength) {
+			break;
+		}
+		char* body = http->in + headLen;
+		char* query = strchr(path, '?');
+		bool traced = false;
+		bool meta = false;
+		bool bitmap = false;
+		int lane = conn->lane;
+		int stagger = 0;
+		if (query != NULL) {
+			*query++ = '\0';
+			traced = strstr(query, "trace=1") != NULL;
+			meta = strstr(query, "meta=1") != NULL;
+			bitmap = strstr(query, "format=bitmap") != NULL;
+			if (strstr(query, "lane=bulk") != NULL) lane = TX_LANE_BULK;
+			if (strstr(query, "lane=interactive") != NULL) lane = TX_LANE_INTERACTIVE;
+			const char* value = strstr(query, "stagger=");
+			if (value != NULL) stagger = atoi(value + 8);
+		}
+
+		/*
+		* route
+		*/
+		http->bodyLen = 0;
+		http->overflow = false;
+		if (strcmp(path, "/states") == 0) {
+			if (strcmp(method, "GET") == 0) {
+				if (bitmap) {
+					getBitmap(http);
+					respond(conn, 200, "OK", keepAlive);
+				}
+				else {
+					getStates(conn, meta, keepAlive, minor >= 1);
+				}
+			}
+			else {
+				respondError(conn, 405, "Method Not Allowed", keepAlive);
+			}
+		}
+		else if (strcmp(path, "/command") == 0) {
+			if (strcmp(method, "POST") == 0) {
+				postCommand(conn, body, contentLength, traced, lane, stagger);
+				respond(conn, 200, "OK", keepAlive);
+			}
+			else {
+				respondError(conn, 405, "Method Not Allowed", keepAlive);
+			}
+		}
+		else if (strcmp(path, "/metrics") == 0 && httpMetrics) {
+			http->bodyLen = statsRenderPrometheus(http->out + HTTP_HEAD_SIZE, HTTP_BODY_SIZE);
+			respond(conn, 200, "OK", keepAlive, "text/plain; version=0.0.4");
+		}
+		else {
+			respondError(conn, 404, "Not Found", keepAlive);
+		}
+
+		// drop the request, keep what is pipelined behind it
+		int used = headLen + contentLength;
+		memmove(http->in, http->in + used, http->inLen - used);
+		http->inLen -= used;
+	}
+	processing = false;
+}
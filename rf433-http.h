@@ -0,0 +1,33 @@
+/**
+ * HTTP/JSON interface of the RCSwitch daemon
+ */
+
+#define HTTP_IN_SIZE 8192
+#define HTTP_HEAD_SIZE 256
+#define HTTP_BODY_SIZE 65536
+// room kept for one plug of GET /states?meta=1 and the end of a chunk
+#define HTTP_STATE_SIZE 128
+// room kept for one result of POST /command?trace=1 and the end of the body
+#define HTTP_RESULT_SIZE 320
+
+struct HttpBuffers {
+	char in[HTTP_IN_SIZE + 1];
+	int inLen;
+	// response is built after HTTP_HEAD_SIZE, the header is put in front of it
+	char out[HTTP_HEAD_SIZE + HTTP_BODY_SIZE];
+	int bodyLen;
+	bool overflow;	// the body did not fit, answered with 507
+	// a GET /states larger than the body goes out in parts, from the
+	// plug streamAddr of the snapshot taken at the request on
+	int streamAddr;	// -1 when nothing is streamed
+	bool streamMeta;
+	bool streamChunked;	// Transfer-Encoding: chunked, else ends with the connection
+	bool streamClose;
+	bool streamFirst;	// no plug rendered yet
+	unsigned long long on[STATE_MAX_WORDS];
+	unsigned long long known[STATE_MAX_WORDS];
+};
+
+void httpOpen(Connection* conn);
+void httpRead(Connection* conn);
+void httpProcess(Connection* conn);
@@ -0,0 +1,101 @@
+/**
+ * reader of the rf433-daemon command journal (--journal)
+ *
+ * Prints the records of the journal files given, oldest file first, one
+ * line each: time, sequence, what happened, plug, state, source, lane and
+ * the code word as tri-state symbols. With -s it prints the plug states
+ * the daemon would rebuild from them instead. Reading a file stops at
+ * the first damaged record, e.g. one cut short by a crash.
+ *
+ * Usage
+ *   rf433-journal-dump [-s] FILE...
+ *
+ * Example
+ *   ./rf433-journal-dump /var/lib/rf433/journal.1 /var/lib/rf433/journal
+ *   2026-10-19 06:30:01.123456 42 accepted 10000116 1 n interactive FFFF00FFFF0F
+ *   2026-10-19 06:30:01.587654 43 sent 10000116 1 n interactive FFFF00FFFF0F
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "rf433-journal.h"
+#include "rf433-protocol.h"
+
+static const char* typeNames[] = { "?", "accepted", "sent", "snapshot" };
+static const char* laneNames[] = { "interactive", "bulk" };
+
+int main(int argc, char* argv[]) {
+	bool states = false;
+
+	int c;
+	while ((c = getopt(argc, argv, "sh")) != -1) {
+		switch (c) {
+			case 's':
+				states = true;
+				break;
+			default:
+				printf("Usage: rf433-journal-dump [-s] FILE...\n");
+				return c == 'h' ? 0 : 1;
+		}
+	}
+	if (optind >= argc) {
+		printf("Usage: rf433-journal-dump [-s] FILE...\n");
+		return 1;
+	}
+
+	int nPlugs = protocolInit();
+	int* state = (int*) malloc(sizeof(int) * nPlugs);
+	for (int addr = 0; addr < nPlugs; addr++) {
+		state[addr] = -1;
+	}
+	int result = 0;
+	for (int i = optind; i < argc; i++) {
+		FILE* file = fopen(argv[i], "rb");
+		if (file == NULL) {
+			perror(argv[i]);
+			result = 1;
+			continue;
+		}
+		JournalRecord record;
+		size_t n;
+		while ((n = fread(&record, 1, sizeof(record), file)) == sizeof(record) && journalValid(&record)) {
+			if (record.addr >= 0 && record.addr < nPlugs && record.type != JOURNAL_SENT) {
+				state[record.addr] = record.state;
+			}
+			if (states) {
+				continue;
+			}
+			char key[16] = "?";
+			if (record.addr >= 0 && record.addr < nPlugs) {
+				protocolKey(record.addr, key);
+			}
+			char when[32];
+			time_t seconds = record.time / 1000000;
+			strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&seconds));
+			char word[13] = "";
+			if (record.type != JOURNAL_SNAPSHOT) {
+				triStateWord(record.bits, word);
+			}
+			printf("%s.%06llu %u %s %s %d %c %s %s\n", when, record.time % 1000000, record.sequence,
+				typeNames[record.type], key, record.state, "ntr?"[record.source < 3 ? record.source : 3],
+				laneNames[record.lane & 1], word);
+		}
+		if (n != 0) {
+			fprintf(stderr, "%s: damaged record after %ld bytes, rest skipped\n", argv[i], ftell(file) - (long) n);
+		}
+		fclose(file);
+	}
+	if (states) {
+		char key[16];
+		for (int addr = 0; addr < nPlugs; addr++) {
+			if (state[addr] >= 0 && protocolKey(addr, key) > 0) {
+				printf("%s %d\n", key, state[addr]);
+			}
+		}
+	}
+	return result;
+}
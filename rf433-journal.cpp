@@ -0,0 +1,346 @@
+/**
+ * write-ahead command journal of the RCSwitch daemon
+ *
+ * With --journal every accepted switch command and every frame sent is
+ * appended to a journal (format in rf433-journal.h), for audits and to
+ * get the state table back after a crash or restart.
+ *
+ * Group commit: workers and the transmit thread only copy their record
+ * into a buffer. The journal thread collects what arrives within
+ * JOURNAL_WINDOW_US, writes it and syncs the file once for all of them.
+ * The journal is written ahead of the radio: the transmit thread waits
+ * until the accepted record of a frame is on disk before the frame goes
+ * on air, so a frame that was sent is always in the journal. Replies to
+ * clients never wait for the disk, while the buffer is full they are
+ * told to retry like with a full queue. A batch that could not be written or
+ * synced is written again from its start until it is on disk, the
+ * frames waiting for it stay off the air meanwhile.
+ *
+ * Once the records after the snapshot exceed the maximum size the file
+ * is rotated, PATH becomes PATH.1, PATH.1 becomes PATH.2 and so on up to
+ * JOURNAL_KEEP, and the new file starts with a snapshot of all known
+ * states.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "rf433-daemon.h"
+#include "rf433-journal.h"
+#include "rf433-stats.h"
+#include "rf433-log.h"
+
+static const char* journalPath = NULL;
+static int journalFd = -1;
+static long journalSize = 0;
+static long snapshotSize = 0;	// the snapshot does not count towards the maximum
+static long journalMaxSize = JOURNAL_MAX_SIZE;
+
+static pthread_mutex_t journalLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t journalPending = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t journalDurable = PTHREAD_COND_INITIALIZER;
+static unsigned char buffer[JOURNAL_BUFFER_SIZE];
+static int used = 0;
+static unsigned long appended = 0;	// sequence of the last record buffered
+static unsigned long durable = 0;	// and of the last one synced
+
+PI_THREAD(journalThread);
+
+static unsigned long long epochUs() {
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return (unsigned long long) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static void fillRecord(JournalRecord* record, unsigned long sequence, int type, int addr, int state, int source, int lane, unsigned long bits) {
+	memset(record, 0, sizeof(JournalRecord));
+	record->time = epochUs();
+	record->sequence = sequence;
+	record->bits = bits;
+	record->addr = addr;
+	record->type = type;
+	record->state = state;
+	record->source = source;
+	record->lane = lane;
+	record->crc = journalCrc(record, sizeof(JournalRecord) - sizeof(record->crc));
+}
+
+/**
+ * apply a journal file to the state table, returns the length of its
+ * valid records and stores that of the snapshot
+ */
+static long restore(const char* path, unsigned long* sequence, int* restored, long* snapshot) {
+	FILE* file = fopen(path, "rb");
+	if (file == NULL) {
+		return 0;
+	}
+	JournalRecord record;
+	long valid = 0;
+	while (fread(&record, sizeof(record), 1, file) == 1 && journalValid(&record)) {
+		valid += sizeof(record);
+		*sequence = record.sequence;
+		if (record.type == JOURNAL_SNAPSHOT) {
+			*snapshot = valid;
+		}
+		if (record.addr < 0 || record.addr >= nPlugs || record.type == JOURNAL_SENT) {
+			continue;
+		}
+		if (!stateIsKnown(record.addr)) {
+			(*restored)++;
+		}
+		stateSet(record.addr, record.state);
+	}
+	fclose(file);
+	return valid;
+}
+
+static void syncDirectory() {
+	char* copy = strdup(journalPath);
+	int fd = open(dirname(copy), O_RDONLY | O_DIRECTORY);
+	if (fd >= 0) {
+		fsync(fd);
+		close(fd);
+	}
+	free(copy);
+}
+
+/**
+ * write a batch at the end of the file and sync it, on failure the file
+ * is cut back to where the batch started; a sync that failed once may
+ * not report the lost pages again, so the whole batch is written anew
+ */
+static bool writeBatch(const unsigned char* out, int len) {
+	int written = 0;
+	while (written < len) {
+		int n = write(journalFd, out + written, len - written);
+		if (n <= 0) {
+			break;
+		}
+		written += n;
+	}
+	if (written == len && fdatasync(journalFd) == 0) {
+		journalSize += len;
+		return true;
+	}
+	if (ftruncate(journalFd, journalSize) < 0 || lseek(journalFd, journalSize, SEEK_SET) < 0) {
+		LOG_E("ERROR cutting back the journal");
+	}
+	return false;
+}
+
+/**
+ * the states are only in the snapshot once the old file was rotated
+ * away, so it is written like a batch until it is on disk
+ */
+static void writeSnapshot(const JournalRecord* snapshot, int n) {
+	while (!writeBatch((const unsigned char*) snapshot, n * sizeof(JournalRecord))) {
+		LOG_E("ERROR writing journal snapshot, retrying");
+		usleep(JOURNAL_RETRY_US);
+	}
+}
+
+/**
+ * start a new file with the state of every known plug
+ * only called by the journal thread, or before it runs
+ */
+static void startFile() {
+	journalFd = open(journalPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0640);
+	if (journalFd < 0) {
+		error("ERROR opening journal");
+	}
+	static JournalRecord snapshot[JOURNAL_BUFFER_SIZE / sizeof(JournalRecord)];
+	int n = 0;
+	journalSize = 0;
+	pthread_mutex_lock(&journalLock);
+	unsigned long sequence = appended;
+	pthread_mutex_unlock(&journalLock);
+	for (int addr = 0; addr < nPlugs; addr++) {
+		if (!stateIsKnown(addr)) {
+			continue;
+		}
+		fillRecord(&snapshot[n++], sequence, JOURNAL_SNAPSHOT, addr, stateGet(addr), 0, 0, 0);
+		if (n == (int) (sizeof(snapshot) / sizeof(snapshot[0]))) {
+			writeSnapshot(snapshot, n);
+			n = 0;
+		}
+	}
+	if (n > 0) {
+		writeSnapshot(snapshot, n);
+	}
+	snapshotSize = journalSize;
+	syncDirectory();
+}
+
+static void rotate() {
+	close(journalFd);
+	int len = strlen(journalPath) + 8;
+	char* from = (char*) malloc(len);
+	char* to = (char*) malloc(len);
+	for (int i = JOURNAL_KEEP - 1; i >= 0; i--) {
+		if (i == 0) {
+			strcpy(from, journalPath);
+		}
+		else {
+			snprintf(from, len, "%s.%d", journalPath, i);
+		}
+		snprintf(to, len, "%s.%d", journalPath, i + 1);
+		rename(from, to);
+	}
+	free(from);
+	free(to);
+	startFile();
+	LOG_I("journal rotated");
+}
+
+/**
+ * move a damaged journal aside to PATH.corrupt, or PATH.corrupt.TIME if
+ * one is already kept
+ */
+static void keepCorrupt() {
+	int len = strlen(journalPath) + 32;
+	char* to = (char*) malloc(len);
+	snprintf(to, len, "%s.corrupt", journalPath);
+	if (access(to, F_OK) == 0) {
+		snprintf(to, len, "%s.corrupt.%ld", journalPath, (long) time(NULL));
+	}
+	if (rename(journalPath, to) < 0) {
+		error("ERROR moving the damaged journal aside");
+	}
+	LOG_W("journal damaged, kept as %s", to);
+	free(to);
+}
+
+/**
+ * rebuild the state table from the journal at PATH and continue it,
+ * maxSize 0 for the default; false if it can't be opened
+ * A journal damaged before its end is moved aside and a new one started
+ * with the states restored up to the damage.
+ */
+bool journalOpen(const char* path, long maxSize) {
+	journalPath = path;
+	if (maxSize > 0) {
+		journalMaxSize = maxSize;
+	}
+	// the previous file first, in case the newest one was cut short
+	char* previous = (char*) malloc(strlen(path) + 3);
+	sprintf(previous, "%s.1", path);
+	unsigned long sequence = 0;
+	int restored = 0;
+	restore(previous, &sequence, &restored, &snapshotSize);
+	free(previous);
+	snapshotSize = 0;
+	long valid = restore(path, &sequence, &restored, &snapshotSize);
+	appended = durable = sequence;
+	LOG_I("journal: state of %d plugs restored", restored);
+
+	journalFd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0640);
+	if (journalFd < 0) {
+		return false;
+	}
+	struct stat status;
+	if (fstat(journalFd, &status) < 0) {
+		return false;
+	}
+	// more than a torn record is damage to look at, not to overwrite
+	if (status.st_size - valid >= (long) sizeof(JournalRecord)) {
+		close(journalFd);
+		keepCorrupt();
+		startFile();
+	}
+	else if (valid == 0) {
+		close(journalFd);
+		startFile();
+	}
+	else {
+		// drop a torn record at the end, the next one follows the last valid
+		if (ftruncate(journalFd, valid) < 0 || lseek(journalFd, valid, SEEK_SET) < 0) {
+			return false;
+		}
+		journalSize = valid;
+	}
+	return piThreadCreate(journalThread) == 0;
+}
+
+/**
+ * add a record, returns its sequence for journalWait(), 0 without journal
+ * A full buffer waits for the disk, or with wait false returns
+ * JOURNAL_FULL at once for callers that hold locks of their own.
+ */
+unsigned long journalAppend(int type, int addr, int state, int source, int lane, unsigned long bits, bool wait) {
+	if (journalFd < 0) {
+		return 0;
+	}
+	pthread_mutex_lock(&journalLock);
+	while (used + (int) sizeof(JournalRecord) > JOURNAL_BUFFER_SIZE) {
+		if (!wait) {
+			pthread_mutex_unlock(&journalLock);
+			return JOURNAL_FULL;
+		}
+		pthread_cond_wait(&journalDurable, &journalLock);
+	}
+	unsigned long sequence = ++appended;
+	fillRecord((JournalRecord*) (buffer + used), sequence, type, addr, state, source, lane, bits);
+	used += sizeof(JournalRecord);
+	pthread_cond_signal(&journalPending);
+	pthread_mutex_unlock(&journalLock);
+	statsCount(STAT_JOURNAL_RECORDS);
+	return sequence;
+}
+
+/**
+ * block until the record with the sequence is on disk
+ */
+void journalWait(unsigned long sequence) {
+	if (sequence == 0) {
+		return;
+	}
+	pthread_mutex_lock(&journalLock);
+	while (durable < sequence) {
+		pthread_cond_wait(&journalDurable, &journalLock);
+	}
+	pthread_mutex_unlock(&journalLock);
+}
+
+PI_THREAD(journalThread) {
+	static unsigned char out[JOURNAL_BUFFER_SIZE];
+	while (true) {
+		pthread_mutex_lock(&journalLock);
+		while (used == 0) {
+			pthread_cond_wait(&journalPending, &journalLock);
+		}
+		pthread_mutex_unlock(&journalLock);
+		// what arrives meanwhile shares the sync
+		usleep(JOURNAL_WINDOW_US);
+
+		pthread_mutex_lock(&journalLock);
+		int len = used;
+		unsigned long sequence = appended;
+		memcpy(out, buffer, len);
+		used = 0;
+		pthread_mutex_unlock(&journalLock);
+
+		// not durable before it is on disk, however long that takes
+		while (!writeBatch(out, len)) {
+			LOG_E("ERROR writing journal, retrying");
+			usleep(JOURNAL_RETRY_US);
+		}
+		statsCount(STAT_JOURNAL_SYNCS);
+
+		pthread_mutex_lock(&journalLock);
+		durable = sequence;
+		pthread_cond_broadcast(&journalDurable);
+		pthread_mutex_unlock(&journalLock);
+
+		if (journalSize - snapshotSize >= journalMaxSize) {
+			rotate();
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,58 @@
+/**
+ * write-ahead command journal of the RCSwitch daemon
+ *
+ * An append-only file of fixed size records, one when a switch command
+ * is accepted (its frame queued) and one when its frame was sent. Every
+ * journal file starts with the known state of all plugs, so the newest
+ * file alone rebuilds the state table. A record that was cut short or
+ * is damaged fails its CRC, reading stops there.
+ */
+
+#define JOURNAL_ACCEPTED 1
+#define JOURNAL_SENT 2
+#define JOURNAL_SNAPSHOT 3	// state of a plug when the file was started
+
+// records are written and synced together once per window
+#define JOURNAL_WINDOW_US 10000
+#define JOURNAL_BUFFER_SIZE 65536
+// a failed write or sync is tried again after this long
+#define JOURNAL_RETRY_US 1000000
+// default size at which the file is rotated, and the rotated files kept
+#define JOURNAL_MAX_SIZE (1024 * 1024)
+#define JOURNAL_KEEP 4
+// journalAppend() without waiting found the buffer full
+#define JOURNAL_FULL ((unsigned long) -1)
+
+struct JournalRecord {
+	unsigned long long time;	// us since the epoch
+	unsigned int sequence;
+	unsigned int bits;	// code word on air
+	int addr;
+	unsigned char type;
+	unsigned char state;
+	unsigned char source;	// EVENT_SOURCE_*
+	unsigned char lane;
+	unsigned int reserved;
+	unsigned int crc;	// CRC-32 of the bytes before
+};
+
+bool journalOpen(const char* path, long maxSize);
+unsigned long journalAppend(int type, int addr, int state, int source, int lane, unsigned long bits, bool wait = true);
+void journalWait(unsigned long sequence);
+
+inline unsigned int journalCrc(const void* data, int len) {
+	const unsigned char* p = (const unsigned char*) data;
+	unsigned int crc = 0xffffffff;
+	for (int i = 0; i < len; i++) {
+		crc ^= p[i];
+		for (int bit = 0; bit < 8; bit++) {
+			crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+		}
+	}
+	return ~crc;
+}
+
+inline bool journalValid(const JournalRecord* record) {
+	return record->type >= JOURNAL_ACCEPTED && record->type <= JOURNAL_SNAPSHOT
+		&& record->crc == journalCrc(record, sizeof(JournalRecord) - sizeof(record->crc));
+}
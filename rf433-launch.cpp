@@ -0,0 +1,178 @@
+/**
+ * on demand launcher for rf433-daemon
+ *
+ * Opens the listening sockets itself and starts the daemon only when the
+ * first client connects, handing the sockets over like systemd socket
+ * activation (LISTEN_FDS, LISTEN_PID, LISTEN_FDNAMES). Clients that
+ * connect while the daemon starts wait in the listen backlog. When the
+ * daemon exits, e.g. with --idle-exit, the launcher waits for the next
+ * client and starts it again. Handy to try socket activation without
+ * systemd, the equivalent units are
+ *
+ *   rf433.socket:  [Socket] ListenStream=11337
+ *                           ListenStream=/run/rf433.sock
+ *   rf433.service: [Service] ExecStart=/usr/local/bin/rf433-daemon -x 300
+ *
+ * Usage
+ *   rf433-launch [-p PORT] [-s PATH] [-H PORT] -- DAEMON [ARGS...]
+ *
+ * Example
+ *   ./rf433-launch -p 11337 -s /tmp/rf433.sock -- ./rf433-daemon -x 60
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+
+#define MAX_SOCKETS 4
+// descriptors are parked here, the daemon gets them from 3 on
+#define PARKED_FD 64
+
+struct Socket {
+	int fd;
+	const char* name;
+};
+
+static Socket sockets[MAX_SOCKETS];
+static int nSockets = 0;
+
+static void park(int fd, const char* name) {
+	int parked = fcntl(fd, F_DUPFD_CLOEXEC, PARKED_FD);
+	if (parked < 0) {
+		perror("ERROR parking socket");
+		exit(1);
+	}
+	close(fd);
+	sockets[nSockets].fd = parked;
+	sockets[nSockets].name = name;
+	nSockets++;
+}
+
+static int listenTcp(int port) {
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = INADDR_ANY;
+	addr.sin_port = htons(port);
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	int on = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	if (fd < 0 || bind(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0 || listen(fd, 64) < 0) {
+		perror("ERROR on TCP listener");
+		exit(1);
+	}
+	return fd;
+}
+
+static int listenUnix(const char* path) {
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+	unlink(path);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || bind(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0 || listen(fd, 64) < 0) {
+		perror("ERROR on unix listener");
+		exit(1);
+	}
+	chmod(path, 0660);
+	return fd;
+}
+
+/**
+ * block until a client is waiting on any of the sockets
+ */
+static void waitForClient() {
+	struct pollfd fds[MAX_SOCKETS];
+	for (int i = 0; i < nSockets; i++) {
+		fds[i].fd = sockets[i].fd;
+		fds[i].events = POLLIN;
+	}
+	while (poll(fds, nSockets, -1) < 0) {
+		if (errno != EINTR) {
+			perror("ERROR on poll");
+			exit(1);
+		}
+	}
+}
+
+static pid_t launch(char* argv[]) {
+	pid_t pid = fork();
+	if (pid != 0) {
+		return pid;
+	}
+	char names[64] = "";
+	for (int i = 0; i < nSockets; i++) {
+		// dup2 clears close-on-exec on the copy
+		dup2(sockets[i].fd, 3 + i);
+		strcat(names, i > 0 ? ":" : "");
+		strcat(names, sockets[i].name);
+	}
+	char value[16];
+	snprintf(value, sizeof(value), "%d", nSockets);
+	setenv("LISTEN_FDS", value, 1);
+	snprintf(value, sizeof(value), "%d", (int) getpid());
+	setenv("LISTEN_PID", value, 1);
+	setenv("LISTEN_FDNAMES", names, 1);
+	execvp(argv[0], argv);
+	perror(argv[0]);
+	_exit(127);
+}
+
+int main(int argc, char* argv[]) {
+	int c;
+	while ((c = getopt(argc, argv, "+p:s:H:h")) != -1) {
+		if (nSockets == MAX_SOCKETS && c != 'h') {
+			printf("too many sockets\n");
+			return 1;
+		}
+		switch (c) {
+			case 'p':
+				park(listenTcp(atoi(optarg)), "raw");
+				break;
+			case 's':
+				park(listenUnix(optarg), "raw");
+				break;
+			case 'H':
+				park(listenTcp(atoi(optarg)), "http");
+				break;
+			default:
+				printf("Usage: rf433-launch [-p PORT] [-s PATH] [-H PORT] -- DAEMON [ARGS...]\n");
+				return c == 'h' ? 0 : 1;
+		}
+	}
+	if (optind >= argc || nSockets == 0) {
+		printf("Usage: rf433-launch [-p PORT] [-s PATH] [-H PORT] -- DAEMON [ARGS...]\n");
+		return 1;
+	}
+
+	while (true) {
+		waitForClient();
+		pid_t pid = launch(argv + optind);
+		if (pid < 0) {
+			perror("ERROR on fork");
+			return 1;
+		}
+		int status;
+		while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+		}
+		if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+			// don't spin on a daemon that can't start
+			printf("daemon exited with %d\n", WEXITSTATUS(status));
+			sleep(1);
+		}
+	}
+	return 0;
+}
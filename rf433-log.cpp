@@ -0,0 +1,267 @@
+/**
+ * asynchronous logger of the RCSwitch daemon
+ *
+ * Producers claim a slot of a bounded multi-producer ring (Vyukov style,
+ * one compare-and-swap per record), copy the arguments and publish the
+ * slot. They never block: if the ring is full the record is dropped and
+ * counted. The logger thread renders the records in order and writes
+ * them to stdout in batches, so a slow pipe or journald only ever stalls
+ * the logger thread and never the transmitter.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <time.h>
+#include <semaphore.h>
+#include <stddef.h>
+
+#include "rf433-daemon.h"
+#include "rf433-log.h"
+
+// power of two
+#define LOG_RING_SIZE 2048
+#define LOG_OUT_SIZE 8192
+
+struct LogSlot {
+	std::atomic<unsigned long> sequence;
+	LogRecord record;
+};
+
+std::atomic<int> logLevel(LOG_INFO);
+
+static LogSlot ring[LOG_RING_SIZE];
+static std::atomic<unsigned long> enqueuePos(0);
+static unsigned long dequeuePos = 0;
+static std::atomic<unsigned long> dropped(0);
+static std::atomic<unsigned long> written(0);
+static std::atomic<bool> sleeping(false);
+static sem_t wake;
+
+static const char* levelNames[] = { "ERROR", "WARN", "INFO", "DEBUG" };
+
+PI_THREAD(logThread);
+
+void logInit(int level) {
+	logLevel.store(level);
+	for (unsigned long i = 0; i < LOG_RING_SIZE; i++) {
+		ring[i].sequence.store(i, std::memory_order_relaxed);
+	}
+	sem_init(&wake, 0, 0);
+	if (piThreadCreate(logThread) != 0) {
+		error("ERROR starting log thread");
+	}
+}
+
+/**
+ * level by number or name, -1 if unknown
+ */
+int logParseLevel(const char* name) {
+	if (name[0] >= '0' && name[0] <= '9') {
+		int level = atoi(name);
+		return level <= LOG_DEBUG ? level : -1;
+	}
+	for (int level = LOG_ERROR; level <= LOG_DEBUG; level++) {
+		if (strcasecmp(name, levelNames[level]) == 0) {
+			return level;
+		}
+	}
+	return -1;
+}
+
+/**
+ * wait up to 100ms until everything logged so far is written, before exit
+ */
+void logFlush() {
+	unsigned long target = enqueuePos.load();
+	for (int i = 0; i < 100 && written.load() < target; i++) {
+		usleep(1000);
+	}
+}
+
+LogRecord* logClaim(int level, const char* format) {
+	unsigned long pos = enqueuePos.load(std::memory_order_relaxed);
+	LogSlot* slot;
+	while (true) {
+		slot = &ring[pos & (LOG_RING_SIZE - 1)];
+		long diff = (long) (slot->sequence.load(std::memory_order_acquire) - pos);
+		if (diff == 0) {
+			if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+				break;
+			}
+		}
+		else if (diff < 0) {
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			return NULL;
+		}
+		else {
+			pos = enqueuePos.load(std::memory_order_relaxed);
+		}
+	}
+	LogRecord* r = &slot->record;
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME_COARSE, &now);
+	r->position = pos;
+	r->time = (long long) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+	r->format = format;
+	r->level = level;
+	r->count = 0;
+	r->poolUsed = 0;
+	return r;
+}
+
+void logArg(LogRecord* r, const char* value) {
+	if (value == NULL) {
+		value = "(null)";
+	}
+	int room = LOG_STRING_POOL - r->poolUsed;
+	int len = strlen(value);
+	if (len >= room) {
+		len = room > 0 ? room - 1 : 0;
+	}
+	r->types[r->count] = LOG_ARG_STRING;
+	r->args[r->count++].offset = r->poolUsed;
+	if (room > 0) {
+		memcpy(r->pool + r->poolUsed, value, len);
+		r->pool[r->poolUsed + len] = '\0';
+		r->poolUsed += len + 1;
+	}
+}
+
+void logCommit(LogRecord* r) {
+	LogSlot* slot = (LogSlot*) ((char*) r - offsetof(LogSlot, record));
+	// seq_cst pairs with the re-check in logThread: either the logger sees
+	// the record or this sees it sleeping, never neither
+	slot->sequence.store(r->position + 1, std::memory_order_seq_cst);
+	if (sleeping.load() && sleeping.exchange(false)) {
+		sem_post(&wake);
+	}
+}
+
+/**
+ * printf the record one conversion at a time with its stored argument,
+ * integer conversions are widened to long long
+ */
+static int render(LogRecord* r, char* out, int size) {
+	struct tm tm;
+	time_t seconds = r->time / 1000;
+	localtime_r(&seconds, &tm);
+	int len = strftime(out, size, "%Y-%m-%d %H:%M:%S", &tm);
+	len += snprintf(out + len, size - len, ".%03d %s ", (int) (r->time % 1000), levelNames[r->level]);
+
+	int arg = 0;
+	const char* p = r->format;
+	while (*p && len < size - 1) {
+		if (*p != '%') {
+			out[len++] = *p++;
+			continue;
+		}
+		if (p[1] == '%') {
+			out[len++] = '%';
+			p += 2;
+			continue;
+		}
+		// copy flags, width and precision, drop length modifiers
+		char spec[24];
+		int n = 0;
+		spec[n++] = *p++;
+		while (*p && strchr("-+ #0123456789.", *p) && n < 16) {
+			spec[n++] = *p++;
+		}
+		while (*p && strchr("hlLqjzt", *p)) {
+			p++;
+		}
+		char conversion = *p ? *p++ : 'd';
+		if (arg >= r->count) {
+			len += snprintf(out + len, size - len, "?");
+			continue;
+		}
+		switch (r->types[arg]) {
+			case LOG_ARG_STRING:
+				spec[n++] = 's';
+				spec[n] = '\0';
+				len += snprintf(out + len, size - len, spec, r->pool + r->args[arg].offset);
+				break;
+			case LOG_ARG_DOUBLE:
+				spec[n++] = strchr("eEfFgGaA", conversion) ? conversion : 'f';
+				spec[n] = '\0';
+				len += snprintf(out + len, size - len, spec, r->args[arg].d);
+				break;
+			default:
+				if (conversion == 'c') {
+					spec[n++] = 'c';
+					spec[n] = '\0';
+					len += snprintf(out + len, size - len, spec, (int) r->args[arg].i);
+				}
+				else {
+					spec[n++] = 'l';
+					spec[n++] = 'l';
+					spec[n++] = strchr("diuxXo", conversion) ? conversion : 'd';
+					spec[n] = '\0';
+					len += snprintf(out + len, size - len, spec, r->args[arg].i);
+				}
+				break;
+		}
+		arg++;
+	}
+	if (len > size - 2) {
+		len = size - 2;
+	}
+	// records are lines, trailing newlines of old printf formats are dropped
+	while (len > 0 && out[len - 1] == '\n') {
+		len--;
+	}
+	out[len++] = '\n';
+	return len;
+}
+
+static void flush(char* out, int* len) {
+	int written = 0;
+	while (written < *len) {
+		int n = write(STDOUT_FILENO, out + written, *len - written);
+		if (n <= 0) {
+			break;
+		}
+		written += n;
+	}
+	*len = 0;
+}
+
+PI_THREAD(logThread) {
+	static char out[LOG_OUT_SIZE];
+	int len = 0;
+	unsigned long reportedDrops = 0;
+	while (true) {
+		LogSlot* slot = &ring[dequeuePos & (LOG_RING_SIZE - 1)];
+		if (slot->sequence.load(std::memory_order_acquire) == dequeuePos + 1) {
+			if (len > LOG_OUT_SIZE - 512) {
+				flush(out, &len);
+			}
+			len += render(&slot->record, out + len, 512);
+			slot->sequence.store(dequeuePos + LOG_RING_SIZE, std::memory_order_release);
+			dequeuePos++;
+			continue;
+		}
+		unsigned long drops = dropped.load(std::memory_order_relaxed);
+		if (drops != reportedDrops) {
+			if (len > LOG_OUT_SIZE - 64) {
+				flush(out, &len);
+			}
+			len += snprintf(out + len, 64, "%lu log records dropped\n", drops - reportedDrops);
+			reportedDrops = drops;
+		}
+		flush(out, &len);
+		written.store(dequeuePos);
+
+		// sleep until a producer commits, re-check to not miss one
+		sleeping.store(true);
+		if (slot->sequence.load(std::memory_order_seq_cst) == dequeuePos + 1) {
+			sleeping.store(false);
+			continue;
+		}
+		sem_wait(&wake);
+	}
+	return 0;
+}
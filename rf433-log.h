@@ -0,0 +1,101 @@
+/**
+ * asynchronous logger of the RCSwitch daemon
+ *
+ * LOG_D("nAddr: %i", nAddr) stores the format pointer and the raw
+ * arguments in a lock-free ring, a background thread formats and writes
+ * them. Formats must be string literals, string arguments are copied.
+ * Records below the run time level cost one load and a branch, setting
+ * LOG_COMPILE_LEVEL removes them completely.
+ */
+
+#include <atomic>
+
+#define LOG_ERROR 0
+#define LOG_WARN 1
+#define LOG_INFO 2
+#define LOG_DEBUG 3
+
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_DEBUG
+#endif
+
+#define LOG_MAX_ARGS 6
+#define LOG_STRING_POOL 64
+
+#define LOG_ARG_INT 0
+#define LOG_ARG_DOUBLE 1
+#define LOG_ARG_STRING 2
+
+struct LogRecord {
+	unsigned long position;	// in the ring
+	long long time;	// ms since the epoch
+	const char* format;
+	unsigned char level;
+	unsigned char count;
+	unsigned char types[LOG_MAX_ARGS];
+	union {
+		long long i;
+		double d;
+		int offset;	// into pool
+	} args[LOG_MAX_ARGS];
+	int poolUsed;
+	char pool[LOG_STRING_POOL];
+};
+
+extern std::atomic<int> logLevel;
+
+void logInit(int level);
+int logParseLevel(const char* name);
+void logFlush();
+LogRecord* logClaim(int level, const char* format);
+void logCommit(LogRecord* record);
+
+inline void logArg(LogRecord* r, long long value) {
+	r->types[r->count] = LOG_ARG_INT;
+	r->args[r->count++].i = value;
+}
+inline void logArg(LogRecord* r, int value) { logArg(r, (long long) value); }
+inline void logArg(LogRecord* r, unsigned int value) { logArg(r, (long long) value); }
+inline void logArg(LogRecord* r, long value) { logArg(r, (long long) value); }
+inline void logArg(LogRecord* r, unsigned long value) { logArg(r, (long long) value); }
+inline void logArg(LogRecord* r, unsigned long long value) { logArg(r, (long long) value); }
+inline void logArg(LogRecord* r, char value) { logArg(r, (long long) value); }
+inline void logArg(LogRecord* r, double value) {
+	r->types[r->count] = LOG_ARG_DOUBLE;
+	r->args[r->count++].d = value;
+}
+void logArg(LogRecord* r, const char* value);
+
+inline void logArgs(LogRecord* r) {
+}
+
+template<typename T, typename... Rest>
+inline void logArgs(LogRecord* r, T value, Rest... rest) {
+	if (r->count < LOG_MAX_ARGS) {
+		logArg(r, value);
+	}
+	logArgs(r, rest...);
+}
+
+template<typename... Args>
+void logWrite(int level, const char* format, Args... args) {
+	LogRecord* r = logClaim(level, format);
+	if (r == NULL) {
+		// ring full, the record is counted as dropped
+		return;
+	}
+	logArgs(r, args...);
+	logCommit(r);
+}
+
+#define LOG(level, ...) \
+	do { \
+		if ((level) <= LOG_COMPILE_LEVEL && (level) <= logLevel.load(std::memory_order_relaxed)) { \
+			logWrite(level, __VA_ARGS__); \
+		} \
+	} while (0)
+
+#define LOG_E(...) LOG(LOG_ERROR, __VA_ARGS__)
+#define LOG_W(...) LOG(LOG_WARN, __VA_ARGS__)
+#define LOG_I(...) LOG(LOG_INFO, __VA_ARGS__)
+#define LOG_D(...) LOG(LOG_DEBUG, __VA_ARGS__)
@@ -0,0 +1,189 @@
+/**
+ * registry of the plug systems the daemon speaks
+ *
+ * One entry per system with its parser, encoder and inverse (command
+ * prefix of an address). protocolInit() lays the address spaces out one
+ * after the other in the order of the table and fills the dispatch table
+ * indexed by the system digit.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "rf433-protocol.h"
+#include "rf433-tx.h"
+
+/*
+ * Elro: 1GGGGGUUA[TTT]
+ */
+static int parseElro(const char* command, CommandContext* ctx) {
+	memcpy(ctx->group, command + 1, 5);
+	ctx->group[5] = '\0';
+	ctx->switchNumber = commandNumber(command + 6);
+	ctx->action = command[8] - '0';
+	ctx->offset = ElroEncoder::address(dipValue(ctx->group), ctx->switchNumber);
+	return RESULT_OK;
+}
+
+static unsigned long encodeElro(const CommandContext* ctx, bool on) {
+	return ElroEncoder::code(dipValue(ctx->group), ctx->switchNumber, on);
+}
+
+static int keyDip(int sys, int offset, char* key) {
+	key[0] = '0' + sys;
+	for (int i = 0; i < 5; i++) {
+		key[5 - i] = (offset & (1 << (i + 5))) ? '1' : '0';
+	}
+	return 6 + sprintf(key + 6, "%02d", offset & 0b00011111);
+}
+
+static int keyElro(int offset, char* key) {
+	return keyDip(ElroEncoder::SYSTEM, offset, key);
+}
+
+/*
+ * Intertechno: 2HHUUA, house and unit 01-16
+ */
+static int parseIntertechno(const char* command, CommandContext* ctx) {
+	memcpy(ctx->group, command + 1, 2);
+	ctx->group[2] = '\0';
+	ctx->switchNumber = commandNumber(command + 3);
+	ctx->action = command[5] - '0';
+	ctx->offset = IntertechnoEncoder::address(atoi(ctx->group), ctx->switchNumber);
+	return ctx->offset < 0 ? RESULT_RANGE : RESULT_OK;
+}
+
+static unsigned long encodeIntertechno(const CommandContext* ctx, bool on) {
+	return IntertechnoEncoder::code(atoi(ctx->group), ctx->switchNumber, on);
+}
+
+static int keyIntertechno(int offset, char* key) {
+	return sprintf(key, "%d%02d%02d", IntertechnoEncoder::SYSTEM, offset / 16 + 1, offset % 16 + 1);
+}
+
+/*
+ * Zap/REV: 3GGGGGNNA[TTT], switch 01-05
+ *
+ * ZAP-Code   Group   (0=open)  | Switch 5..1 (ex.5)| On=01 Off=10
+ * send code  1   1   0   0   0 | 1   0   0   0   0 |
+ * tri-state  0   0   F   F   F | 1   F   F   0   0 | 1   0
+ * binary     00  00  01  01  01| 11  01  01  00  00| 00  11
+ */
+static int parseZap(const char* command, CommandContext* ctx) {
+	memcpy(ctx->group, command + 1, 5);
+	ctx->group[5] = '\0';
+	ctx->switchNumber = commandNumber(command + 6);
+	ctx->action = command[8] - '0';
+	ctx->offset = ZapEncoder::address(dipValue(ctx->group), ctx->switchNumber);
+	return ZapEncoder::valid(ctx->switchNumber) ? RESULT_OK : RESULT_RANGE;
+}
+
+static unsigned long encodeZap(const CommandContext* ctx, bool on) {
+	// on goes out as the off code, see transmit() in rf433-tx.cpp
+	return ZapEncoder::code(dipValue(ctx->group), ctx->switchNumber, on ? 0 : 1);
+}
+
+static int keyZap(int offset, char* key) {
+	if (!ZapEncoder::valid(offset & 31)) {
+		return 0;
+	}
+	return keyDip(ZapEncoder::SYSTEM, offset, key);
+}
+
+static Protocol protocols[] = {
+	{ ElroEncoder::SYSTEM, "elro", ElroEncoder::ADDR_SIZE, ElroEncoder::PULSE_LENGTH, TX_ELRO, 9, 'O', 'O',
+		parseElro, encodeElro, keyElro, 0 },
+	{ IntertechnoEncoder::SYSTEM, "intertechno", IntertechnoEncoder::ADDR_SIZE, IntertechnoEncoder::PULSE_LENGTH, TX_TRISTATE, 6, '1', '0',
+		parseIntertechno, encodeIntertechno, keyIntertechno, 0 },
+	{ ZapEncoder::SYSTEM, "zap", ZapEncoder::ADDR_SIZE, ZapEncoder::PULSE_LENGTH, TX_ZAP, 9, '1', '0',
+		parseZap, encodeZap, keyZap, 0 },
+};
+
+static const int nProtocols = sizeof(protocols) / sizeof(protocols[0]);
+static const Protocol* byDigit[PROTOCOL_DIGITS];
+
+/**
+ * assign the address spaces, returns the size of the state table
+ */
+int protocolInit() {
+	int size = 0;
+	for (int i = 0; i < nProtocols; i++) {
+		protocols[i].base = size;
+		size += protocols[i].addrSize;
+		byDigit[protocols[i].system] = &protocols[i];
+	}
+	return size;
+}
+
+int protocolCount() {
+	return nProtocols;
+}
+
+const Protocol* protocolAt(int index) {
+	return &protocols[index];
+}
+
+/**
+ * system of a command by its first character, NULL if there is none
+ */
+const Protocol* protocolFor(char digit) {
+	unsigned index = digit - '0';
+	return index < PROTOCOL_DIGITS ? byDigit[index] : NULL;
+}
+
+/**
+ * command prefix (system, group and switch) of a state address, e.g.
+ * 10000116, returns the key length, 0 for addresses no plug uses
+ */
+int protocolKey(int addr, char* key) {
+	for (int i = 0; i < nProtocols; i++) {
+		int offset = addr - protocols[i].base;
+		if (offset >= 0 && offset < protocols[i].addrSize) {
+			return protocols[i].key(offset, key);
+		}
+	}
+	return 0;
+}
+
+/**
+ * state address of a command prefix, the reverse of protocolKey(), -1
+ * if it is no plug
+ */
+int protocolAddress(const char* key) {
+	char command[20];
+	snprintf(command, sizeof(command), "%s2", key);
+	const Protocol* protocol = protocolFor(command[0]);
+	CommandContext ctx;
+	memset(&ctx, 0, sizeof(ctx));
+	if (protocol == NULL || (int) strlen(command) < protocol->minLength || protocol->parse(command, &ctx) != RESULT_OK) {
+		return -1;
+	}
+	return protocol->base + ctx.offset;
+}
+
+static int waveBit(unsigned char* wave, int n, int bit) {
+	// protocol 1: 0 is 1 high 3 low, 1 is 3 high 1 low
+	wave[n] = bit ? 3 : 1;
+	wave[n + 1] = bit ? 1 : 3;
+	return n + 2;
+}
+
+/**
+ * waveform of one repeat of a code word the way rc-switch sends it,
+ * protocol 1 with 24 bits and the sync, PROTOCOL_WAVE_PULSES high and low
+ * times in pulse lengths, returns their sum
+ */
+int protocolWave(unsigned long bits, unsigned char* wave) {
+	int n = 0;
+	int pulses = 0;
+	for (int i = 23; i >= 0; i--) {
+		n = waveBit(wave, n, (bits >> i) & 1);
+	}
+	wave[n++] = 1;
+	wave[n++] = 31;
+	for (int i = 0; i < n; i++) {
+		pulses += wave[i];
+	}
+	return pulses;
+}
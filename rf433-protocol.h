@@ -0,0 +1,234 @@
+/**
+ * encoders of the supported plug systems, shared by send and the daemon
+ *
+ * Every system is a type with constexpr functions turning a command into
+ * the address of the plug within the system and the 24 bit code word
+ * rc-switch sends with protocol 1. A code word holds 12 tri-state symbols of two bits each,
+ * 0 = 00, F = 01, 1 = 11, the first symbol in the high bits. The symbol
+ * tables are generated at compile time and checked against the documented
+ * examples with static_assert below, so a wrong table does not build.
+ *
+ *   1  Elro         1GGGGGUUA   group DIP switches, unit A=16 ... E=1
+ *   2  Intertechno  2HHUUA      house 01-16 (A-P), unit 01-16
+ *   3  Zap/REV      3GGGGGNNA   group (1 = closed), switch 01-05
+ *
+ * A is 0 for off, 1 for on and 2 for the status.
+ *
+ * At run time the systems are kept in a registry (rf433-protocol.cpp):
+ * each entry declares the size of its address space, its parser, its
+ * encoder, its pulse length and how it is transmitted. The state table
+ * is the address spaces one after the other and commands are dispatched
+ * by their first digit through a flat table. A new system is a new
+ * encoder type and one more entry there.
+ */
+
+struct SymbolTable {
+	unsigned long bits[32];
+};
+
+/**
+ * 5 DIP switches as tri-state symbols, the first switch in the high
+ * bits: a switch that is on (1) is sent as 0, an open one as F
+ */
+constexpr SymbolTable makeDipSymbols() {
+	SymbolTable table = {};
+	for (int value = 0; value < 32; value++) {
+		for (int i = 4; i >= 0; i--) {
+			table.bits[value] = table.bits[value] << 2 | (((value >> i) & 1) ^ 1);
+		}
+	}
+	return table;
+}
+
+/**
+ * Intertechno house and unit codes, code - 1 in 4 symbols with the lowest
+ * bit first and a set bit as F: A = 0000, B = F000 ... P = FFFF
+ */
+constexpr SymbolTable makeNibbleSymbols() {
+	SymbolTable table = {};
+	for (int value = 0; value < 16; value++) {
+		for (int i = 0; i < 4; i++) {
+			table.bits[value] = table.bits[value] << 2 | ((value >> i) & 1);
+		}
+	}
+	return table;
+}
+
+static constexpr SymbolTable DIP_SYMBOLS = makeDipSymbols();
+static constexpr SymbolTable NIBBLE_SYMBOLS = makeNibbleSymbols();
+
+constexpr int commandNumber(const char* s) {
+	return (s[0] - '0') * 10 + (s[1] - '0');
+}
+
+/**
+ * DIP switches like "00001" as a number, anything but 1 is off
+ */
+constexpr int dipValue(const char* s) {
+	return (s[0] == '1') << 4 | (s[1] == '1') << 3 | (s[2] == '1') << 2 | (s[3] == '1') << 1 | (s[4] == '1');
+}
+
+/**
+ * code word of a tri-state string like "FFFF00FFFF0F"
+ */
+constexpr unsigned long triStateBits(const char* word) {
+	unsigned long bits = 0;
+	for (int i = 0; word[i] != '\0'; i++) {
+		bits = bits << 2 | (word[i] == '1' ? 3 : word[i] == '0' ? 0 : 1);
+	}
+	return bits;
+}
+
+/**
+ * tri-state string of a code word, 12 symbols and the terminating 0
+ */
+inline void triStateWord(unsigned long bits, char* word) {
+	for (int i = 0; i < 12; i++) {
+		word[i] = "0F?1"[(bits >> (22 - 2 * i)) & 3];
+	}
+	word[12] = '\0';
+}
+
+struct ElroEncoder {
+	static constexpr int SYSTEM = 1;
+	static constexpr int ADDR_SIZE = 1024;
+	static constexpr int PULSE_LENGTH = 350;
+
+	// unit 1..5 of send and the remote as DIP switch, A = 16 ... E = 1
+	static constexpr int unitSwitch(int unit) {
+		return 1 << (5 - unit);
+	}
+	// within the system: group in the upper 5 bits, unit DIP switches in
+	// the lower
+	static constexpr int address(int group, int unit) {
+		return group << 5 | (unit & 31);
+	}
+	// group, unit, then 0F for on and F0 for off
+	static constexpr unsigned long code(int group, int unit, bool on) {
+		return DIP_SYMBOLS.bits[group & 31] << 14 | DIP_SYMBOLS.bits[unit & 31] << 4 | (0b0100 >> (on * 2));
+	}
+	static constexpr int address(const char* command) {
+		return address(dipValue(command + 1), commandNumber(command + 6));
+	}
+	static constexpr unsigned long code(const char* command) {
+		return code(dipValue(command + 1), commandNumber(command + 6), command[8] == '1');
+	}
+};
+
+struct IntertechnoEncoder {
+	static constexpr int SYSTEM = 2;
+	static constexpr int ADDR_SIZE = 256;
+	static constexpr int PULSE_LENGTH = 300;
+
+	static constexpr bool valid(int house, int unit) {
+		return house >= 1 && house <= 16 && unit >= 1 && unit <= 16;
+	}
+	// within the system, -1 for codes out of range
+	static constexpr int address(int house, int unit) {
+		return valid(house, unit) ? (house - 1) * 16 + unit - 1 : -1;
+	}
+	// house, unit, the mandatory 0F, then FF for on and F0 for off
+	static constexpr unsigned long code(int house, int unit, bool on) {
+		return NIBBLE_SYMBOLS.bits[(house - 1) & 15] << 16 | NIBBLE_SYMBOLS.bits[(unit - 1) & 15] << 8 | 0b0001 << 4 | 0b0100 | on;
+	}
+	static constexpr int address(const char* command) {
+		return address(commandNumber(command + 1), commandNumber(command + 3));
+	}
+	static constexpr unsigned long code(const char* command) {
+		return code(commandNumber(command + 1), commandNumber(command + 3), command[5] == '1');
+	}
+};
+
+struct ZapEncoder {
+	static constexpr int SYSTEM = 3;
+	static constexpr int ADDR_SIZE = 1024;
+	static constexpr int PULSE_LENGTH = 188;
+
+	static constexpr bool valid(int number) {
+		return number >= 1 && number <= 5;
+	}
+	// same layout as Elro, the switch number in the lower bits
+	static constexpr int address(int group, int number) {
+		return group << 5 | (number & 31);
+	}
+	/**
+	 * group like Elro, switches 5..1 as F F F 0 0 with the selected one
+	 * 1, then 01 for on and 10 for off (not tri-state, sent as bits)
+	 *   311000051  00 00 01 01 01 | 11 01 01 00 00 | 00 11
+	 */
+	static constexpr unsigned long code(int group, int number, int action) {
+		return DIP_SYMBOLS.bits[group & 31] << 14 | 3UL << (2 * (number + 1)) | 0b01010100000000 | (0b1100 >> (action * 2));
+	}
+	static constexpr int address(const char* command) {
+		return address(dipValue(command + 1), commandNumber(command + 6));
+	}
+	static constexpr unsigned long code(const char* command) {
+		return code(dipValue(command + 1), commandNumber(command + 6), command[8] - '0');
+	}
+};
+
+static_assert(DIP_SYMBOLS.bits[0] == triStateBits("FFFFF"), "DIP switches all open");
+static_assert(NIBBLE_SYMBOLS.bits[1] == triStateBits("F000"), "Intertechno B");
+static_assert(NIBBLE_SYMBOLS.bits[15] == triStateBits("FFFF"), "Intertechno P");
+static_assert(ElroEncoder::address("100001161") == 48, "Elro 100001161");
+static_assert(ElroEncoder::code("100001161") == triStateBits("FFFF00FFFF0F"), "Elro 100001161");
+static_assert(ElroEncoder::code("100001160") == triStateBits("FFFF00FFFFF0"), "Elro 100001160");
+static_assert(IntertechnoEncoder::address("202021") == 17, "Intertechno 202021");
+static_assert(IntertechnoEncoder::code("202021") == triStateBits("F000F0000FFF"), "Intertechno 202021");
+static_assert(IntertechnoEncoder::code("216160") == triStateBits("FFFFFFFF0FF0"), "Intertechno 216160");
+static_assert(IntertechnoEncoder::address("217011") == -1, "Intertechno house out of range");
+static_assert(ZapEncoder::address("300FFF051") == 5, "Zap 300FFF051");
+static_assert(ZapEncoder::code("300FFF051") == 5600515, "Zap 300FFF051");
+static_assert(ZapEncoder::code("311000051") == 357635, "Zap 311000051, on as sent by the remote");
+static_assert(ZapEncoder::code("311000050") == 357644, "Zap 311000050, off as sent by the remote");
+
+/*
+ * registry
+ */
+
+#define RESULT_OK 0
+#define RESULT_RANGE 1
+#define RESULT_INVALID 2
+
+// system digits 0..9
+#define PROTOCOL_DIGITS 10
+// high and low times of one repeat: 24 bits and the sync
+#define PROTOCOL_WAVE_PULSES ((24 + 1) * 2)
+
+/**
+ * a command while it is parsed, one per request and worker
+ */
+struct CommandContext {
+	int sys;
+	char group[6];
+	int switchNumber;
+	int action;
+	int timeout;	// minutes, parsed but not used
+	int offset;	// address within the system
+};
+
+struct Protocol {
+	int system;
+	const char* name;
+	int addrSize;
+	int pulseLength;
+	int txType;	// TX_ELRO, TX_TRISTATE or TX_ZAP
+	int minLength;	// shortest command
+	char onReply;	// legacy one byte replies
+	char offReply;
+	// fills ctx, returns RESULT_OK, RESULT_RANGE or RESULT_INVALID
+	int (*parse)(const char* command, CommandContext* ctx);
+	// code word that goes on air
+	unsigned long (*encode)(const CommandContext* ctx, bool on);
+	// command prefix of an address within the system, 0 if unused
+	int (*key)(int offset, char* key);
+	int base;	// first state address, set by protocolInit()
+};
+
+int protocolInit();
+int protocolCount();
+const Protocol* protocolAt(int index);
+const Protocol* protocolFor(char digit);
+int protocolKey(int addr, char* key);
+int protocolAddress(const char* key);
+int protocolWave(unsigned long bits, unsigned char* wave);
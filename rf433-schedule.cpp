@@ -0,0 +1,486 @@
+/**
+ * recurring schedules of the RCSwitch daemon
+ *
+ * Replaces system cron calling send or nc for daily routines: the
+ * schedules (rf433-schedule.h) live in the daemon and one timer thread
+ * sleeps until the next one is due. Its switch command then goes through
+ * handleMessage like one from a client, in the bulk lane and with the
+ * timer as source, without a rate limit. When the queue is busy it is
+ * tried again once the reply allows. Runs missed while the daemon was
+ * down are skipped.
+ *
+ * With --schedules=PATH they are kept in PATH, one per line as given to
+ * "schedule add" with its id first, and rewritten on every change.
+ *
+ *   schedule [list]                 one line per schedule with the time
+ *                                   of its next run
+ *   schedule add EXPRESSION         the new schedule, as listed
+ *   schedule set ID EXPRESSION      replaces one
+ *   schedule del ID                 O, or E range
+ *     echo schedule add 30 6 \* \* mon-fri ~600 100001161 | nc localhost 11337
+ *     1 30 6 * * mon-fri ~600 100001161 next=1760934600
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "rf433-daemon.h"
+#include "rf433-schedule.h"
+#include "rf433-events.h"
+#include "rf433-tx.h"
+#include "rf433-log.h"
+
+static const char* schedulePath = NULL;
+static Schedule schedules[SCHEDULE_MAX];
+static int nextId = 1;
+static unsigned int seed = 1;
+
+static pthread_mutex_t scheduleLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t scheduleChanged = PTHREAD_COND_INITIALIZER;
+
+static const char* monthNames[] = { "jan", "feb", "mar", "apr", "may", "jun", "jul", "aug", "sep", "oct", "nov", "dec", NULL };
+static const char* weekdayNames[] = { "sun", "mon", "tue", "wed", "thu", "fri", "sat", NULL };
+
+PI_THREAD(scheduleThread);
+
+/**
+ * a number or a name, names[0] is first
+ */
+static const char* fieldValue(const char* p, const char** names, int first, int* value) {
+	if (names != NULL) {
+		for (int i = 0; names[i] != NULL; i++) {
+			if (strncasecmp(p, names[i], 3) == 0) {
+				*value = first + i;
+				return p + 3;
+			}
+		}
+	}
+	if (*p < '0' || *p > '9') {
+		return NULL;
+	}
+	char* end;
+	*value = strtol(p, &end, 10);
+	return end;
+}
+
+/**
+ * one cron field into a bit mask of min to max
+ */
+static bool parseField(const char* text, int min, int max, const char** names, unsigned long long* mask) {
+	*mask = 0;
+	const char* p = text;
+	while (true) {
+		int from = min;
+		int to = max;
+		int step = 1;
+		if (*p == '*') {
+			p++;
+		}
+		else {
+			p = fieldValue(p, names, min, &from);
+			if (p == NULL) {
+				return false;
+			}
+			to = from;
+			if (*p == '-') {
+				p = fieldValue(p + 1, names, min, &to);
+				if (p == NULL) {
+					return false;
+				}
+			}
+		}
+		if (*p == '/') {
+			char* end;
+			step = strtol(p + 1, &end, 10);
+			p = end;
+			if (step < 1) {
+				return false;
+			}
+			if (from == to) {
+				to = max;
+			}
+		}
+		if (from < min || to > max || from > to) {
+			return false;
+		}
+		for (int v = from; v <= to; v += step) {
+			*mask |= 1ULL << v;
+		}
+		if (*p == '\0') {
+			return true;
+		}
+		if (*p != ',') {
+			return false;
+		}
+		p++;
+	}
+}
+
+static bool dayMatches(const Schedule* s, const struct tm* t) {
+	bool day = (s->days >> t->tm_mday) & 1;
+	bool weekday = (s->weekdays >> t->tm_wday) & 1;
+	// cron: with both restricted either one is enough
+	if (!s->anyDay && !s->anyWeekday) {
+		return day || weekday;
+	}
+	return day && weekday;
+}
+
+/**
+ * first minute after the time that matches the expression, 0 if none
+ * within a few years (e.g. february 30)
+ */
+static long nextMatch(const Schedule* s, long after) {
+	time_t at = after - after % 60 + 60;
+	struct tm t;
+	localtime_r(&at, &t);
+	for (int steps = 0; steps < 100000; steps++) {
+		if (!((s->months >> (t.tm_mon + 1)) & 1)) {
+			t.tm_mon++;
+			t.tm_mday = 1;
+			t.tm_hour = 0;
+			t.tm_min = 0;
+		}
+		else if (!dayMatches(s, &t)) {
+			t.tm_mday++;
+			t.tm_hour = 0;
+			t.tm_min = 0;
+		}
+		else if (!((s->hours >> t.tm_hour) & 1)) {
+			t.tm_hour++;
+			t.tm_min = 0;
+		}
+		else if (!((s->minutes >> t.tm_min) & 1)) {
+			t.tm_min++;
+		}
+		else {
+			t.tm_isdst = -1;
+			return mktime(&t);
+		}
+		// normalizes the fields, e.g. the 32nd into the next month
+		t.tm_isdst = -1;
+		mktime(&t);
+	}
+	return 0;
+}
+
+/**
+ * "MIN HOUR DOM MON DOW [~SECONDS] COMMAND" into the schedule
+ */
+static bool parseSchedule(const char* text, Schedule* s) {
+	char fields[5][24];
+	char rest[2][SCHEDULE_COMMAND_SIZE];
+	int n = sscanf(text, "%23s %23s %23s %23s %23s %31s %31s", fields[0], fields[1], fields[2], fields[3], fields[4], rest[0], rest[1]);
+	if (n < 6) {
+		return false;
+	}
+	unsigned long long mask;
+	memset(s, 0, sizeof(Schedule));
+	if (!parseField(fields[0], 0, 59, NULL, &s->minutes)) {
+		return false;
+	}
+	if (!parseField(fields[1], 0, 23, NULL, &mask)) {
+		return false;
+	}
+	s->hours = mask;
+	if (!parseField(fields[2], 1, 31, NULL, &mask)) {
+		return false;
+	}
+	s->days = mask;
+	if (!parseField(fields[3], 1, 12, monthNames, &mask)) {
+		return false;
+	}
+	s->months = mask;
+	if (!parseField(fields[4], 0, 7, weekdayNames, &mask)) {
+		return false;
+	}
+	// 7 is sunday as well
+	s->weekdays = (mask | mask >> 7) & 0x7f;
+	s->anyDay = strcmp(fields[2], "*") == 0;
+	s->anyWeekday = strcmp(fields[4], "*") == 0;
+	const char* command = rest[0];
+	if (rest[0][0] == '~') {
+		if (n < 7) {
+			return false;
+		}
+		s->jitter = atoi(rest[0] + 1);
+		command = rest[1];
+	}
+
+	// only switch commands of a known system
+	const Protocol* protocol = protocolFor(command[0]);
+	CommandContext ctx;
+	memset(&ctx, 0, sizeof(ctx));
+	if (protocol == NULL || (int) strlen(command) < protocol->minLength
+			|| protocol->parse(command, &ctx) != RESULT_OK || ctx.action > 1) {
+		return false;
+	}
+	strcpy(s->command, command);
+	snprintf(s->spec, sizeof(s->spec), "%s %s %s %s %s", fields[0], fields[1], fields[2], fields[3], fields[4]);
+	return true;
+}
+
+/**
+ * next run after the time, called with the lock held
+ */
+static void plan(Schedule* s, long after) {
+	s->base = nextMatch(s, after);
+	s->due = s->base;
+	if (s->base != 0 && s->jitter > 0) {
+		s->due += rand_r(&seed) % (s->jitter + 1);
+	}
+}
+
+static int format(const Schedule* s, char* buffer, int size) {
+	int len;
+	if (s->jitter > 0) {
+		len = snprintf(buffer, size, "%d %s ~%d %s next=%ld\n", s->id, s->spec, s->jitter, s->command, s->due);
+	}
+	else {
+		len = snprintf(buffer, size, "%d %s %s next=%ld\n", s->id, s->spec, s->command, s->due);
+	}
+	return len < size ? len : 0;
+}
+
+/**
+ * write all schedules to PATH.tmp and move it over PATH, with the lock
+ */
+static void save() {
+	if (schedulePath == NULL) {
+		return;
+	}
+	char* tmp = (char*) malloc(strlen(schedulePath) + 5);
+	sprintf(tmp, "%s.tmp", schedulePath);
+	FILE* file = fopen(tmp, "w");
+	if (file == NULL) {
+		LOG_E("ERROR writing schedules to %s", tmp);
+		free(tmp);
+		return;
+	}
+	for (int i = 0; i < SCHEDULE_MAX; i++) {
+		Schedule* s = &schedules[i];
+		if (s->id == 0) {
+			continue;
+		}
+		if (s->jitter > 0) {
+			fprintf(file, "%d %s ~%d %s\n", s->id, s->spec, s->jitter, s->command);
+		}
+		else {
+			fprintf(file, "%d %s %s\n", s->id, s->spec, s->command);
+		}
+	}
+	fflush(file);
+	fsync(fileno(file));
+	fclose(file);
+	if (rename(tmp, schedulePath) < 0) {
+		LOG_E("ERROR writing schedules to %s", schedulePath);
+	}
+	free(tmp);
+}
+
+static Schedule* find(int id) {
+	for (int i = 0; i < SCHEDULE_MAX; i++) {
+		if (id > 0 && schedules[i].id == id) {
+			return &schedules[i];
+		}
+	}
+	return NULL;
+}
+
+/**
+ * load the schedules of PATH, if given, and start the timer thread
+ */
+bool scheduleInit(const char* path) {
+	schedulePath = path;
+	seed = time(NULL) ^ getpid();
+	long now = time(NULL);
+	FILE* file = path != NULL ? fopen(path, "r") : NULL;
+	if (file != NULL) {
+		char line[256];
+		int loaded = 0;
+		while (fgets(line, sizeof(line), file) != NULL) {
+			int id;
+			int skip;
+			if (line[0] == '#' || sscanf(line, "%d %n", &id, &skip) != 1) {
+				continue;
+			}
+			// a bad line must not clear an earlier one of the same id
+			Schedule parsed;
+			if (id <= 0 || !parseSchedule(line + skip, &parsed) || nextMatch(&parsed, now) == 0) {
+				LOG_W("schedule skipped: %s", line);
+				continue;
+			}
+			Schedule* s = find(id);
+			for (int i = 0; i < SCHEDULE_MAX && s == NULL; i++) {
+				if (schedules[i].id == 0) {
+					s = &schedules[i];
+				}
+			}
+			if (s == NULL) {
+				LOG_W("schedule skipped: %s", line);
+				continue;
+			}
+			*s = parsed;
+			s->id = id;
+			plan(s, now);
+			if (id >= nextId) {
+				nextId = id + 1;
+			}
+			loaded++;
+		}
+		fclose(file);
+		LOG_I("%d schedules loaded", loaded);
+	}
+	return piThreadCreate(scheduleThread) == 0;
+}
+
+/**
+ * answer of "schedule [list|add|set|del] ..."
+ */
+int scheduleCommand(const char* args, char* buffer, int size) {
+	char verb[8] = "list";
+	int skip = 0;
+	sscanf(args, " %7s %n", verb, &skip);
+	const char* rest = args + skip;
+	long now = time(NULL);
+	int len = 0;
+
+	pthread_mutex_lock(&scheduleLock);
+	if (strcmp(verb, "list") == 0) {
+		for (int i = 0; i < SCHEDULE_MAX; i++) {
+			if (schedules[i].id != 0) {
+				int added = format(&schedules[i], buffer + len, size - len);
+				if (added == 0) {
+					break;
+				}
+				len += added;
+			}
+		}
+		if (len == 0) {
+			len = snprintf(buffer, size, "\n");
+		}
+	}
+	else if (strcmp(verb, "add") == 0 || strcmp(verb, "set") == 0) {
+		Schedule parsed;
+		Schedule* s = NULL;
+		int id = 0;
+		if (verb[0] == 's') {
+			if (sscanf(rest, "%d %n", &id, &skip) == 1) {
+				s = find(id);
+				rest += skip;
+			}
+		}
+		else {
+			for (int i = 0; i < SCHEDULE_MAX && s == NULL; i++) {
+				if (schedules[i].id == 0) {
+					s = &schedules[i];
+				}
+			}
+			id = nextId;
+		}
+		if (s == NULL) {
+			len = snprintf(buffer, size, verb[0] == 's' ? "E range\n" : "E full\n");
+		}
+		else if (!parseSchedule(rest, &parsed) || nextMatch(&parsed, now) == 0) {
+			len = snprintf(buffer, size, "E invalid\n");
+		}
+		else {
+			*s = parsed;
+			s->id = id;
+			if (id == nextId) {
+				nextId++;
+			}
+			plan(s, now);
+			save();
+			pthread_cond_signal(&scheduleChanged);
+			len = format(s, buffer, size);
+		}
+	}
+	else if (strcmp(verb, "del") == 0) {
+		Schedule* s = find(atoi(rest));
+		if (s == NULL) {
+			len = snprintf(buffer, size, "E range\n");
+		}
+		else {
+			s->id = 0;
+			save();
+			pthread_cond_signal(&scheduleChanged);
+			len = snprintf(buffer, size, "O\n");
+		}
+	}
+	else {
+		len = snprintf(buffer, size, "E invalid\n");
+	}
+	pthread_mutex_unlock(&scheduleLock);
+	return len;
+}
+
+PI_THREAD(scheduleThread) {
+	struct Run {
+		int id;
+		long base;
+		char command[SCHEDULE_COMMAND_SIZE];
+	};
+	static Run runs[SCHEDULE_MAX];
+	pthread_mutex_lock(&scheduleLock);
+	while (true) {
+		// sleep until the next run or a change
+		long now = time(NULL);
+		long next = 0;
+		int n = 0;
+		for (int i = 0; i < SCHEDULE_MAX; i++) {
+			Schedule* s = &schedules[i];
+			if (s->id == 0 || s->due == 0) {
+				continue;
+			}
+			if (s->due <= now) {
+				runs[n].id = s->id;
+				runs[n].base = s->base;
+				strcpy(runs[n].command, s->command);
+				n++;
+			}
+			else if (next == 0 || s->due < next) {
+				next = s->due;
+			}
+		}
+		if (n == 0) {
+			if (next == 0) {
+				pthread_cond_wait(&scheduleChanged, &scheduleLock);
+			}
+			else {
+				struct timespec until = { next, 0 };
+				pthread_cond_timedwait(&scheduleChanged, &scheduleLock, &until);
+			}
+			continue;
+		}
+
+		pthread_mutex_unlock(&scheduleLock);
+		CommandResult results[SCHEDULE_MAX];
+		for (int i = 0; i < n; i++) {
+			LOG_I("schedule %d: %s", runs[i].id, runs[i].command);
+			handleMessage(runs[i].command, EVENT_SOURCE_TIMER, TX_LANE_BULK, 0, &results[i]);
+		}
+		pthread_mutex_lock(&scheduleLock);
+
+		now = time(NULL);
+		for (int i = 0; i < n; i++) {
+			Schedule* s = find(runs[i].id);
+			if (s == NULL || s->base != runs[i].base) {
+				// changed meanwhile
+				continue;
+			}
+			if (results[i].status == RESULT_BUSY) {
+				s->due = now + 1 + results[i].retryAfter / 1000;
+				continue;
+			}
+			// from now on, a jump of the clock doesn't replay the runs in between
+			plan(s, s->base > now ? s->base : now);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,33 @@
+/**
+ * recurring schedules of the RCSwitch daemon
+ *
+ * A schedule is a cron expression, minute hour day-of-month month
+ * day-of-week, each field "*", a number, a range "A-B", a step "/N" of
+ * either or a list of them, months and weekdays also by name (jan, mon).
+ * An optional "~SECONDS" delays every run by a random 0 to SECONDS, the
+ * switch command follows:
+ *   30 6 * * mon-fri ~600 100001161
+ */
+
+#define SCHEDULE_MAX 128
+#define SCHEDULE_COMMAND_SIZE 32
+#define SCHEDULE_SPEC_SIZE 128
+
+struct Schedule {
+	int id;	// 0 for a free slot
+	char spec[SCHEDULE_SPEC_SIZE];	// the five fields as given
+	unsigned long long minutes;	// bit per minute, hour, ...
+	unsigned int hours;
+	unsigned int days;	// 1 to 31
+	unsigned short months;	// 1 to 12
+	unsigned char weekdays;	// 0 is sunday
+	bool anyDay;	// day-of-month "*"
+	bool anyWeekday;
+	int jitter;	// seconds
+	char command[SCHEDULE_COMMAND_SIZE];
+	long base;	// next match of the expression, seconds since the epoch
+	long due;	// base plus the random offset, or a retry when busy
+};
+
+bool scheduleInit(const char* path);
+int scheduleCommand(const char* args, char* buffer, int size);
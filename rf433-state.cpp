@@ -0,0 +1,93 @@
+/**
+ * plug state table of the RCSwitch daemon
+ *
+ * Bulk readers copy the bitmaps word by word into plain arrays first
+ * (stateSnapshot), which takes a few cache lines and leaves the scans
+ * over them to ordinary loops the compiler can vectorize.
+ *
+ *   bitmap
+ *     plugs=2304 known=3 on=2
+ *     on 0000000000000000...
+ *     known 0000000000000000...
+ *   16 hex digits per word of 64 plugs, in address order, the lowest
+ *   address of a word in its lowest bit
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rf433-daemon.h"
+
+int stateWords = 0;
+std::atomic<unsigned long long>* stateOn;
+std::atomic<unsigned long long>* stateKnown;
+PlugMeta* plugMeta;
+
+void stateInit(int plugs) {
+	if (plugs > STATE_MAX_PLUGS) {
+		error("ERROR more plugs than STATE_MAX_PLUGS");
+	}
+	stateWords = (plugs + STATE_WORD_BITS - 1) / STATE_WORD_BITS;
+	stateOn = new std::atomic<unsigned long long>[stateWords]();
+	stateKnown = new std::atomic<unsigned long long>[stateWords]();
+	plugMeta = new PlugMeta[plugs]();
+	for (int addr = 0; addr < plugs; addr++) {
+		plugMeta[addr].pending.store(STATE_PENDING_NONE, std::memory_order_relaxed);
+	}
+}
+
+/**
+ * copy both bitmaps, stateWords words each
+ */
+void stateSnapshot(unsigned long long* on, unsigned long long* known) {
+	for (int i = 0; i < stateWords; i++) {
+		on[i] = stateOn[i].load(std::memory_order_relaxed);
+		known[i] = stateKnown[i].load(std::memory_order_relaxed);
+	}
+}
+
+/**
+ * set bits of the addresses from up to, not including, to
+ */
+int stateCount(const unsigned long long* bits, int from, int to) {
+	if (from >= to) {
+		return 0;
+	}
+	int first = from / STATE_WORD_BITS;
+	int last = (to - 1) / STATE_WORD_BITS;
+	unsigned long long head = ~0ULL << (from % STATE_WORD_BITS);
+	unsigned long long tail = ~0ULL >> (STATE_WORD_BITS - 1 - (to - 1) % STATE_WORD_BITS);
+	if (first == last) {
+		return __builtin_popcountll(bits[first] & head & tail);
+	}
+	int count = __builtin_popcountll(bits[first] & head) + __builtin_popcountll(bits[last] & tail);
+	for (int i = first + 1; i < last; i++) {
+		count += __builtin_popcountll(bits[i]);
+	}
+	return count;
+}
+
+int stateHex(const unsigned long long* bits, char* out, int size) {
+	int len = 0;
+	for (int i = 0; i < stateWords && len + 16 < size; i++) {
+		len += sprintf(out + len, "%016llx", bits[i]);
+	}
+	return len;
+}
+
+/**
+ * answer of "bitmap"
+ */
+int stateBitmap(char* out, int size) {
+	unsigned long long on[STATE_MAX_WORDS];
+	unsigned long long known[STATE_MAX_WORDS];
+	stateSnapshot(on, known);
+	int len = snprintf(out, size, "plugs=%d known=%d on=%d\non ", nPlugs,
+		stateCount(known, 0, nPlugs), stateCount(on, 0, nPlugs));
+	len += stateHex(on, out + len, size - len - 8);
+	len += sprintf(out + len, "\nknown ");
+	len += stateHex(known, out + len, size - len - 2);
+	out[len++] = '\n';
+	return len;
+}
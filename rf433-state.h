@@ -0,0 +1,55 @@
+/**
+ * plug state table of the RCSwitch daemon
+ *
+ * The hot part is two bitmaps, 64 plugs per word: whether a plug is on
+ * and whether a command ever set it. A status query reads one word, all
+ * 2304 plugs fit into 5 cache lines. What is only needed now and then
+ * lives in a separate cold array, one PlugMeta per plug.
+ *
+ * Bits are set by the transmit queue when a frame is queued, the
+ * metadata under its lock as well; readers take no lock.
+ */
+
+#define STATE_WORD_BITS 64
+// upper bound of the registered address spaces, snapshots of the bitmaps
+// fit on the stack
+#define STATE_MAX_PLUGS 4096
+#define STATE_MAX_WORDS (STATE_MAX_PLUGS / STATE_WORD_BITS)
+#define STATE_PENDING_NONE 0xff
+
+struct PlugMeta {
+	std::atomic<unsigned int> changed;	// seconds since the epoch of the last change
+	std::atomic<unsigned char> source;	// EVENT_SOURCE_* of it
+	std::atomic<unsigned char> pending;	// state of the frame waiting in the queue
+};
+
+extern int stateWords;
+extern std::atomic<unsigned long long>* stateOn;
+extern std::atomic<unsigned long long>* stateKnown;
+extern PlugMeta* plugMeta;
+
+inline int stateGet(int addr) {
+	return (stateOn[addr / STATE_WORD_BITS].load(std::memory_order_relaxed) >> (addr % STATE_WORD_BITS)) & 1;
+}
+
+inline bool stateIsKnown(int addr) {
+	return (stateKnown[addr / STATE_WORD_BITS].load(std::memory_order_relaxed) >> (addr % STATE_WORD_BITS)) & 1;
+}
+
+/**
+ * store the state of a plug, returns the one it had
+ */
+inline int stateSet(int addr, int state) {
+	unsigned long long bit = 1ULL << (addr % STATE_WORD_BITS);
+	unsigned long long word = state
+		? stateOn[addr / STATE_WORD_BITS].fetch_or(bit)
+		: stateOn[addr / STATE_WORD_BITS].fetch_and(~bit);
+	stateKnown[addr / STATE_WORD_BITS].fetch_or(bit, std::memory_order_relaxed);
+	return (word & bit) != 0;
+}
+
+void stateInit(int plugs);
+void stateSnapshot(unsigned long long* on, unsigned long long* known);
+int stateCount(const unsigned long long* bits, int from, int to);
+int stateHex(const unsigned long long* bits, char* out, int size);
+int stateBitmap(char* out, int size);
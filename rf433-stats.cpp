@@ -0,0 +1,278 @@
+/**
+ * metrics of the RCSwitch daemon
+ *
+ * Every thread counts into its own shard, so the hot path never shares
+ * a cache line or takes a lock: an update is a plain load and store of
+ * a relaxed atomic only the owning thread writes. Readers walk the list
+ * of shards and sum them up when stats are requested.
+ *
+ * Latencies are kept in log-linear histograms (HDR style) in microseconds,
+ * exact up to 16us and with 8 buckets per power of two above, which
+ * keeps the relative error below 12.5% up to about an hour. Accept-to-parse
+ * is fed from the request traces, the others are measured by the
+ * transmit thread for every frame.
+ *
+ *   accept-to-parse  request read from the client until parsing starts
+ *   queue wait       frame queued until it goes on air, in total and
+ *                    per lane (interactive, bulk)
+ *   on-air           time the transmitter is busy with one frame
+ *   on-air error     how far that is off the airtime of the rendered
+ *                    waveform, the timing error of the pulses
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <atomic>
+
+#include "rf433-daemon.h"
+#include "rf433-stats.h"
+
+typedef std::atomic<unsigned long long> Counter;
+
+struct StatsShard {
+	Counter counters[STAT_COUNTERS];
+	Counter commands[STAT_SYSTEMS][STAT_ACTIONS];
+	Counter buckets[HIST_COUNT][HIST_BUCKETS];
+	Counter sums[HIST_COUNT];
+	StatsShard* next;
+};
+
+struct StatsSnapshot {
+	unsigned long long counters[STAT_COUNTERS];
+	unsigned long long commands[STAT_SYSTEMS][STAT_ACTIONS];
+	unsigned long long buckets[HIST_COUNT][HIST_BUCKETS];
+	unsigned long long sums[HIST_COUNT];
+	unsigned long long counts[HIST_COUNT];
+};
+
+static StatsShard* shards = NULL;
+static pthread_mutex_t shardsLock = PTHREAD_MUTEX_INITIALIZER;
+static thread_local StatsShard* shard = NULL;
+static std::atomic<int> queueDepth(0);
+static std::atomic<long> queueAirtime(0);
+static std::atomic<long> dutyCycle(0);
+
+static const char* histogramNames[HIST_COUNT] = { "accept_to_parse", "queue_wait", "on_air", "queue_wait_interactive", "queue_wait_bulk", "on_air_error" };
+static const char* actionNames[STAT_ACTIONS] = { "off", "on", "status", "other" };
+
+static StatsShard* getShard() {
+	if (shard == NULL) {
+		shard = (StatsShard*) calloc(1, sizeof(StatsShard));
+		if (shard == NULL) {
+			error("ERROR allocating stats");
+		}
+		pthread_mutex_lock(&shardsLock);
+		shard->next = shards;
+		shards = shard;
+		pthread_mutex_unlock(&shardsLock);
+	}
+	return shard;
+}
+
+// only the owning thread writes, so no read-modify-write is needed
+static inline void bump(Counter& counter, unsigned long long value) {
+	counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+static int bucketIndex(unsigned long long us) {
+	if (us < 16) {
+		return us;
+	}
+	int msb = 63 - __builtin_clzll(us);
+	int index = 16 + (msb - 4) * 8 + ((us >> (msb - 3)) & 7);
+	return index < HIST_BUCKETS ? index : HIST_BUCKETS - 1;
+}
+
+// largest value counted in the bucket
+static unsigned long long bucketUpper(int index) {
+	if (index < 16) {
+		return index;
+	}
+	int msb = (index - 16) / 8 + 4;
+	int sub = (index - 16) % 8;
+	return ((unsigned long long) (8 + sub + 1) << (msb - 3)) - 1;
+}
+
+/**
+ * monotonic clock in microseconds
+ */
+long statsNow() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+void statsCount(int counter) {
+	bump(getShard()->counters[counter], 1);
+}
+
+void statsCommand(int sys, int action) {
+	if (sys < 0 || sys >= STAT_SYSTEMS) sys = 0;
+	if (action < 0 || action >= STAT_ACTIONS) action = STAT_ACTIONS - 1;
+	bump(getShard()->commands[sys][action], 1);
+}
+
+void statsRecord(int histogram, long us) {
+	if (us < 0) {
+		us = 0;
+	}
+	StatsShard* s = getShard();
+	bump(s->buckets[histogram][bucketIndex(us)], 1);
+	bump(s->sums[histogram], us);
+}
+
+void statsSetQueueDepth(int depth) {
+	queueDepth.store(depth, std::memory_order_relaxed);
+}
+
+void statsSetQueueAirtime(long ms) {
+	queueAirtime.store(ms, std::memory_order_relaxed);
+}
+
+/**
+ * airtime sent in the duty cycle window, in 1/1000 of the window
+ */
+void statsSetDutyCycle(long permille) {
+	dutyCycle.store(permille, std::memory_order_relaxed);
+}
+
+static void snapshot(StatsSnapshot* snap) {
+	memset(snap, 0, sizeof(StatsSnapshot));
+	pthread_mutex_lock(&shardsLock);
+	for (StatsShard* s = shards; s != NULL; s = s->next) {
+		for (int i = 0; i < STAT_COUNTERS; i++) {
+			snap->counters[i] += s->counters[i].load(std::memory_order_relaxed);
+		}
+		for (int sys = 0; sys < STAT_SYSTEMS; sys++) {
+			for (int action = 0; action < STAT_ACTIONS; action++) {
+				snap->commands[sys][action] += s->commands[sys][action].load(std::memory_order_relaxed);
+			}
+		}
+		for (int h = 0; h < HIST_COUNT; h++) {
+			for (int b = 0; b < HIST_BUCKETS; b++) {
+				unsigned long long n = s->buckets[h][b].load(std::memory_order_relaxed);
+				snap->buckets[h][b] += n;
+				snap->counts[h] += n;
+			}
+			snap->sums[h] += s->sums[h].load(std::memory_order_relaxed);
+		}
+	}
+	pthread_mutex_unlock(&shardsLock);
+}
+
+static unsigned long long percentile(StatsSnapshot* snap, int h, double q) {
+	unsigned long long rank = (unsigned long long) (q * snap->counts[h]);
+	if (rank >= snap->counts[h] && rank > 0) {
+		rank = snap->counts[h] - 1;
+	}
+	unsigned long long seen = 0;
+	for (int b = 0; b < HIST_BUCKETS; b++) {
+		seen += snap->buckets[h][b];
+		if (seen > rank) {
+			return bucketUpper(b);
+		}
+	}
+	return 0;
+}
+
+#define APPEND(...) \
+	do { \
+		if (len < size) len += snprintf(buffer + len, size - len, __VA_ARGS__); \
+	} while (0)
+
+/**
+ * human readable stats, answer of the "stats" command
+ */
+int statsRender(char* buffer, int size) {
+	StatsSnapshot snap;
+	snapshot(&snap);
+	int len = 0;
+	for (int sys = 0; sys < STAT_SYSTEMS; sys++) {
+		for (int action = 0; action < STAT_ACTIONS; action++) {
+			if (snap.commands[sys][action] != 0) {
+				APPEND("commands sys=%d action=%s %llu\n", sys, actionNames[action], snap.commands[sys][action]);
+			}
+		}
+	}
+	APPEND("parse_errors %llu\n", snap.counters[STAT_PARSE_ERRORS]);
+	APPEND("out_of_range %llu\n", snap.counters[STAT_OUT_OF_RANGE]);
+	APPEND("busy_rate_limited %llu\n", snap.counters[STAT_BUSY_RATE]);
+	APPEND("busy_airtime %llu\n", snap.counters[STAT_BUSY_AIRTIME]);
+	APPEND("busy_journal %llu\n", snap.counters[STAT_BUSY_JOURNAL]);
+	APPEND("superseded %llu\n", snap.counters[STAT_SUPERSEDED]);
+	APPEND("queue_depth %d\n", queueDepth.load(std::memory_order_relaxed));
+	APPEND("queue_airtime_ms %ld\n", queueAirtime.load(std::memory_order_relaxed));
+	APPEND("duty_cycle_percent %.1f\n", dutyCycle.load(std::memory_order_relaxed) / 10.0);
+	APPEND("deferred_duty_cycle %llu\n", snap.counters[STAT_DEFERRED]);
+	APPEND("staggered %llu\n", snap.counters[STAT_STAGGERED]);
+	APPEND("journal_records %llu\n", snap.counters[STAT_JOURNAL_RECORDS]);
+	APPEND("journal_syncs %llu\n", snap.counters[STAT_JOURNAL_SYNCS]);
+	for (int h = 0; h < HIST_COUNT; h++) {
+		APPEND("%s_us count=%llu mean=%llu p50=%llu p90=%llu p99=%llu max=%llu\n",
+			histogramNames[h], snap.counts[h],
+			snap.counts[h] ? snap.sums[h] / snap.counts[h] : 0,
+			percentile(&snap, h, 0.5), percentile(&snap, h, 0.9),
+			percentile(&snap, h, 0.99), percentile(&snap, h, 1.0));
+	}
+	return len < size ? len : size - 1;
+}
+
+/**
+ * Prometheus text format, served on /metrics
+ * histograms only list the buckets that were hit
+ */
+int statsRenderPrometheus(char* buffer, int size) {
+	StatsSnapshot snap;
+	snapshot(&snap);
+	int len = 0;
+	APPEND("# TYPE rf433_commands_total counter\n");
+	for (int sys = 0; sys < STAT_SYSTEMS; sys++) {
+		for (int action = 0; action < STAT_ACTIONS; action++) {
+			if (snap.commands[sys][action] != 0) {
+				APPEND("rf433_commands_total{system=\"%d\",action=\"%s\"} %llu\n", sys, actionNames[action], snap.commands[sys][action]);
+			}
+		}
+	}
+	APPEND("# TYPE rf433_parse_errors_total counter\n");
+	APPEND("rf433_parse_errors_total %llu\n", snap.counters[STAT_PARSE_ERRORS]);
+	APPEND("# TYPE rf433_out_of_range_total counter\n");
+	APPEND("rf433_out_of_range_total %llu\n", snap.counters[STAT_OUT_OF_RANGE]);
+	APPEND("# TYPE rf433_busy_total counter\n");
+	APPEND("rf433_busy_total{reason=\"rate\"} %llu\n", snap.counters[STAT_BUSY_RATE]);
+	APPEND("rf433_busy_total{reason=\"airtime\"} %llu\n", snap.counters[STAT_BUSY_AIRTIME]);
+	APPEND("rf433_busy_total{reason=\"journal\"} %llu\n", snap.counters[STAT_BUSY_JOURNAL]);
+	APPEND("# TYPE rf433_superseded_total counter\n");
+	APPEND("rf433_superseded_total %llu\n", snap.counters[STAT_SUPERSEDED]);
+	APPEND("# TYPE rf433_queue_depth gauge\n");
+	APPEND("rf433_queue_depth %d\n", queueDepth.load(std::memory_order_relaxed));
+	APPEND("# TYPE rf433_queue_airtime_seconds gauge\n");
+	APPEND("rf433_queue_airtime_seconds %.3f\n", queueAirtime.load(std::memory_order_relaxed) / 1e3);
+	APPEND("# TYPE rf433_duty_cycle_ratio gauge\n");
+	APPEND("rf433_duty_cycle_ratio %.3f\n", dutyCycle.load(std::memory_order_relaxed) / 1e3);
+	APPEND("# TYPE rf433_deferred_total counter\n");
+	APPEND("rf433_deferred_total %llu\n", snap.counters[STAT_DEFERRED]);
+	APPEND("# TYPE rf433_staggered_total counter\n");
+	APPEND("rf433_staggered_total %llu\n", snap.counters[STAT_STAGGERED]);
+	APPEND("# TYPE rf433_journal_records_total counter\n");
+	APPEND("rf433_journal_records_total %llu\n", snap.counters[STAT_JOURNAL_RECORDS]);
+	APPEND("# TYPE rf433_journal_syncs_total counter\n");
+	APPEND("rf433_journal_syncs_total %llu\n", snap.counters[STAT_JOURNAL_SYNCS]);
+	for (int h = 0; h < HIST_COUNT; h++) {
+		APPEND("# TYPE rf433_%s_seconds histogram\n", histogramNames[h]);
+		unsigned long long cumulative = 0;
+		for (int b = 0; b < HIST_BUCKETS; b++) {
+			if (snap.buckets[h][b] == 0) {
+				continue;
+			}
+			cumulative += snap.buckets[h][b];
+			APPEND("rf433_%s_seconds_bucket{le=\"%.6f\"} %llu\n", histogramNames[h], bucketUpper(b) / 1e6, cumulative);
+		}
+		APPEND("rf433_%s_seconds_bucket{le=\"+Inf\"} %llu\n", histogramNames[h], snap.counts[h]);
+		APPEND("rf433_%s_seconds_sum %.6f\n", histogramNames[h], snap.sums[h] / 1e6);
+		APPEND("rf433_%s_seconds_count %llu\n", histogramNames[h], snap.counts[h]);
+	}
+	return len < size ? len : size - 1;
+}
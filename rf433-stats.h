@@ -0,0 +1,40 @@
+/**
+ * metrics of the RCSwitch daemon
+ */
+
+#define STAT_PARSE_ERRORS 0
+#define STAT_OUT_OF_RANGE 1
+#define STAT_BUSY_RATE 2	// client over its rate, told to retry
+#define STAT_BUSY_AIRTIME 3	// queue full or over the airtime budget
+#define STAT_SUPERSEDED 4	// queued frame replaced by a newer one
+#define STAT_DEFERRED 5	// low priority frame held back by the duty cycle
+#define STAT_JOURNAL_RECORDS 6
+#define STAT_JOURNAL_SYNCS 7	// one per group commit
+#define STAT_STAGGERED 8	// on frame that waited for the stagger of its circuit
+#define STAT_BUSY_JOURNAL 9	// journal buffer full, the disk is behind
+#define STAT_COUNTERS 10
+
+#define HIST_ACCEPT_TO_PARSE 0
+#define HIST_QUEUE_WAIT 1
+#define HIST_ON_AIR 2
+#define HIST_QUEUE_WAIT_INTERACTIVE 3
+#define HIST_QUEUE_WAIT_BULK 4
+#define HIST_ON_AIR_ERROR 5	// on air time off the rendered airtime
+#define HIST_COUNT 6
+
+// systems 1..3 plus 0 for unknown, actions off/on/status/other
+#define STAT_SYSTEMS 4
+#define STAT_ACTIONS 4
+
+// log-linear buckets: 16 exact values, then 8 buckets per power of two
+#define HIST_BUCKETS 240
+
+long statsNow();
+void statsCount(int counter);
+void statsCommand(int sys, int action);
+void statsRecord(int histogram, long us);
+void statsSetQueueDepth(int depth);
+void statsSetQueueAirtime(long ms);
+void statsSetDutyCycle(long permille);
+int statsRender(char* buffer, int size);
+int statsRenderPrometheus(char* buffer, int size);
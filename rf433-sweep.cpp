@@ -0,0 +1,171 @@
+/**
+ * pairing sweep over a range of addresses, shared by send and the daemon
+ *
+ * Calling send once per candidate costs a process, wiringPiSetup() and
+ * ten repeats per address; a whole system took minutes. A sweep encodes
+ * and renders all its frames before the first goes on air, each to the
+ * high and low times in us, and sends every code only SWEEP_REPEAT
+ * times. The loop that sends them does nothing but toggle the pin at
+ * deadlines measured from the start of the frame, so the error of one
+ * pulse is not carried into the next and the frames follow each other
+ * with the sync pause of the protocol as the only gap.
+ *
+ * Airtime of a full sweep at the default pulse lengths and repeats:
+ *   Elro         1024 addresses  about 92 s
+ *   Intertechno   256 addresses  about 20 s
+ *   Zap           160 addresses  about  8 s
+ * One Elro group (32 unit settings) takes 3 s.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wiringPi.h>
+
+#include "rf433-protocol.h"
+#include "rf433-sweep.h"
+
+/**
+ * state addresses of a range like "1" or "10000001-10011131", NULL or
+ * what is wrong with it
+ */
+static const char* sweepRange(const char* spec, const Protocol** protocol, int* from, int* to) {
+	*protocol = protocolFor(spec[0]);
+	if (*protocol == NULL) {
+		return "unknown system";
+	}
+	if (spec[1] == '\0') {
+		*from = (*protocol)->base;
+		*to = (*protocol)->base + (*protocol)->addrSize - 1;
+		return NULL;
+	}
+	char first[20];
+	const char* dash = strchr(spec, '-');
+	int len = dash != NULL ? dash - spec : strlen(spec);
+	if (len >= (int) sizeof(first)) {
+		return "key too long";
+	}
+	memcpy(first, spec, len);
+	first[len] = '\0';
+	*from = protocolAddress(first);
+	*to = dash != NULL ? protocolAddress(dash + 1) : *from;
+	if (*from < 0 || *to < 0) {
+		return "no plug key";
+	}
+	if (dash != NULL && dash[1] != spec[0]) {
+		return "range over two systems";
+	}
+	if (*from > *to) {
+		return "range backwards";
+	}
+	return NULL;
+}
+
+/**
+ * encode and render the frames of a range, pulse overrides the pulse
+ * length, else pulses (us per state address, 0 for the system's) when
+ * not NULL, returns NULL or what is wrong
+ * protocolInit() must have run
+ */
+const char* sweepPlan(SweepPlan* plan, const char* spec, bool on, int repeat, int gap, int pulse, const unsigned short* pulses) {
+	int from, to;
+	memset(plan, 0, sizeof(*plan));
+	const char* failed = sweepRange(spec, &plan->protocol, &from, &to);
+	if (failed != NULL) {
+		return failed;
+	}
+	if (repeat < 1 || gap < 0 || pulse < 0 || pulse > SWEEP_PULSE_MAX) {
+		return "repeat, gap or pulse out of range";
+	}
+	const Protocol* protocol = plan->protocol;
+	plan->addrs = (int*) malloc(sizeof(int) * (to - from + 1));
+	plan->wave = (unsigned short*) malloc(sizeof(unsigned short) * PROTOCOL_WAVE_PULSES * (to - from + 1));
+	if (plan->addrs == NULL || plan->wave == NULL) {
+		return "out of memory";
+	}
+	plan->repeat = repeat;
+	plan->gap = gap;
+	plan->on = on;
+	for (int addr = from; addr <= to; addr++) {
+		char command[20];
+		int len = protocolKey(addr, command);
+		if (len == 0) {
+			continue;
+		}
+		command[len] = on ? '1' : '0';
+		command[len + 1] = '\0';
+		CommandContext ctx;
+		memset(&ctx, 0, sizeof(ctx));
+		if (protocol->parse(command, &ctx) != RESULT_OK) {
+			continue;
+		}
+		int length = pulse > 0 ? pulse : pulses != NULL && pulses[addr] != 0 ? pulses[addr] : protocol->pulseLength;
+		// a profile may be longer than the rendered times can hold
+		if (length > SWEEP_PULSE_MAX) {
+			return "pulse of a profile too long for a sweep, give pulse=";
+		}
+		unsigned char wave[PROTOCOL_WAVE_PULSES];
+		long pulseCount = protocolWave(protocol->encode(&ctx, on), wave);
+		unsigned short* out = plan->wave + plan->count * PROTOCOL_WAVE_PULSES;
+		for (int i = 0; i < PROTOCOL_WAVE_PULSES; i++) {
+			out[i] = wave[i] * length;
+		}
+		plan->addrs[plan->count++] = addr;
+		plan->airtime += repeat * pulseCount * length + gap;
+	}
+	return NULL;
+}
+
+void sweepFree(SweepPlan* plan) {
+	free(plan->addrs);
+	free(plan->wave);
+	plan->addrs = NULL;
+	plan->wave = NULL;
+	plan->count = 0;
+}
+
+/**
+ * us on air of one frame with its repeats and gap
+ */
+long sweepFrameAirtime(const SweepPlan* plan, int index) {
+	const unsigned short* wave = plan->wave + index * PROTOCOL_WAVE_PULSES;
+	long airtime = 0;
+	for (int i = 0; i < PROTOCOL_WAVE_PULSES; i++) {
+		airtime += wave[i];
+	}
+	return airtime * plan->repeat + plan->gap;
+}
+
+/**
+ * sleep through most of the time to a deadline of micros(), spin the
+ * rest
+ */
+static void waitFor(unsigned int at) {
+	int left = (int) (at - micros());
+	if (left > 200) {
+		delayMicroseconds(left - 100);
+	}
+	while ((int) (at - micros()) > 0) {
+	}
+}
+
+/**
+ * put one rendered frame on air, repeat times, then stay silent for gap
+ * us; the pin must be an output
+ */
+void sweepSend(const unsigned short* wave, int repeat, int gap, int pin) {
+	unsigned int at = micros();
+	for (int r = 0; r < repeat; r++) {
+		for (int i = 0; i < PROTOCOL_WAVE_PULSES; i += 2) {
+			digitalWrite(pin, HIGH);
+			at += wave[i];
+			waitFor(at);
+			digitalWrite(pin, LOW);
+			at += wave[i + 1];
+			waitFor(at);
+		}
+	}
+	if (gap > 0) {
+		waitFor(at + gap);
+	}
+}
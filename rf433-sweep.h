@@ -0,0 +1,34 @@
+/**
+ * pairing sweep over a range of addresses, shared by send and the daemon
+ *
+ * A sweep sends the on (or off) frame of every address of a range, for
+ * learning plugs in pairing mode or to find the DIP setting of a plug
+ * that lost its label. The range is given as
+ *   1                    every address of system 1
+ *   10000116             one plug
+ *   10000001-10011131    the keys of one system from, to, in address order
+ */
+
+// frames of one code in a row, receivers take a code once they decoded
+// it twice
+#define SWEEP_REPEAT 2
+// us, keeps the sync pause of a frame within an unsigned short
+#define SWEEP_PULSE_MAX 2000
+
+struct Protocol;
+
+struct SweepPlan {
+	const Protocol* protocol;
+	int count;	// frames
+	int* addrs;	// state address of each frame
+	unsigned short* wave;	// PROTOCOL_WAVE_PULSES high and low times in us per frame
+	int repeat;
+	int gap;	// us of silence after each frame
+	long airtime;	// us of the whole sweep
+	bool on;
+};
+
+const char* sweepPlan(SweepPlan* plan, const char* spec, bool on, int repeat, int gap, int pulse, const unsigned short* pulses);
+void sweepFree(SweepPlan* plan);
+long sweepFrameAirtime(const SweepPlan* plan, int index);
+void sweepSend(const unsigned short* wave, int repeat, int gap, int pin);
@@ -0,0 +1,113 @@
+/**
+ * per request tracing of the RCSwitch daemon
+ *
+ * Every command gets an id and monotonic timestamps when it was accepted
+ * (read from the client), parsed, queued for the transmitter and when
+ * the transmission started and ended. The last TRACE_RING_SIZE traces
+ * are kept in a ring for the "traces" command, a single trace can be
+ * returned with the reply. Recording is one clock read per stage, the
+ * latency histograms of the stats are fed from the same timestamps.
+ *
+ * Replies go out when the frame is queued, the transmit stages of a
+ * trace are filled in later by the transmit thread.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+
+#include "rf433-daemon.h"
+#include "rf433-trace.h"
+#include "rf433-stats.h"
+
+static TraceRecord ring[TRACE_RING_SIZE];
+static std::atomic<unsigned long> nextId(1);
+static thread_local TraceRecord* current = NULL;
+
+static const char* statusNames[] = { "ok", "range", "invalid", "busy" };
+
+/**
+ * start the trace of a command, parsing starts now
+ */
+TraceRecord* traceBegin(long acceptedAt, const char* command) {
+	unsigned long id = nextId.fetch_add(1);
+	TraceRecord* trace = &ring[id & (TRACE_RING_SIZE - 1)];
+	trace->id = id;
+	strncpy(trace->command, command, sizeof(trace->command) - 1);
+	trace->command[sizeof(trace->command) - 1] = '\0';
+	// cut the newline of "echo ... | nc"
+	trace->command[strcspn(trace->command, "\r\n")] = '\0';
+	trace->addr = -1;
+	trace->status = 0;
+	trace->accept = acceptedAt;
+	trace->parse = statsNow();
+	trace->enqueue = 0;
+	trace->txStart = 0;
+	trace->txEnd = 0;
+	statsRecord(HIST_ACCEPT_TO_PARSE, trace->parse - trace->accept);
+	current = trace;
+	return trace;
+}
+
+void traceEnd(TraceRecord* trace, int addr, int status) {
+	trace->addr = addr;
+	trace->status = status;
+	current = NULL;
+}
+
+/**
+ * the trace of the command the calling worker is parsing, NULL if none
+ */
+TraceRecord* traceCurrent() {
+	return current;
+}
+
+void traceEnqueue(TraceRecord* trace) {
+	if (trace != NULL) {
+		trace->enqueue = statsNow();
+	}
+}
+
+/**
+ * called by the transmit thread around the frame of a command
+ */
+void traceTxBegin(TraceRecord* trace) {
+	if (trace == NULL) {
+		return;
+	}
+	trace->txStart = statsNow();
+}
+
+void traceTxEnd(TraceRecord* trace) {
+	if (trace == NULL) {
+		return;
+	}
+	trace->txEnd = statsNow();
+}
+
+static long relative(TraceRecord* trace, long stamp) {
+	return stamp == 0 ? -1 : stamp - trace->accept;
+}
+
+/**
+ * one line, stages in us relative to accept, -1 for stages not reached
+ */
+int traceFormat(TraceRecord* trace, char* buffer, int size) {
+	return snprintf(buffer, size, "id=%lu cmd=%s addr=%d status=%s accept=0 parse=%ld enqueue=%ld tx_start=%ld tx_end=%ld\n",
+		trace->id, trace->command, trace->addr, statusNames[trace->status],
+		relative(trace, trace->parse), relative(trace, trace->enqueue),
+		relative(trace, trace->txStart), relative(trace, trace->txEnd));
+}
+
+/**
+ * the kept traces, oldest first
+ */
+int traceDump(char* buffer, int size) {
+	int len = 0;
+	unsigned long last = nextId.load();
+	unsigned long first = last > TRACE_RING_SIZE ? last - TRACE_RING_SIZE : 1;
+	for (unsigned long id = first; id < last && len < size - TRACE_LINE_SIZE; id++) {
+		len += traceFormat(&ring[id & (TRACE_RING_SIZE - 1)], buffer + len, size - len);
+	}
+	return len;
+}
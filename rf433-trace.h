@@ -0,0 +1,29 @@
+/**
+ * per request tracing of the RCSwitch daemon
+ */
+
+// power of two, number of requests kept for the "traces" command
+#define TRACE_RING_SIZE 256
+#define TRACE_LINE_SIZE 160
+
+struct TraceRecord {
+	unsigned long id;
+	char command[16];
+	int addr;
+	int status;
+	// monotonic us, 0 if the stage was not reached
+	long accept;
+	long parse;
+	long enqueue;
+	long txStart;
+	long txEnd;
+};
+
+TraceRecord* traceBegin(long acceptedAt, const char* command);
+void traceEnd(TraceRecord* trace, int addr, int status);
+TraceRecord* traceCurrent();
+void traceEnqueue(TraceRecord* trace);
+void traceTxBegin(TraceRecord* trace);
+void traceTxEnd(TraceRecord* trace);
+int traceFormat(TraceRecord* trace, char* buffer, int size);
+int traceDump(char* buffer, int size);
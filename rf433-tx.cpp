@@ -0,0 +1,705 @@
+/**
+ * transmit thread of the RCSwitch daemon
+ *
+ * There is one transmitter, so there is one thread owning it. Workers
+ * parse and validate commands in parallel and hand over finished frames
+ * through a FIFO queue; the transmit thread sends them one after the
+ * other. The new plug state is stored when the frame is queued, in the
+ * same critical section, so the state table, the order of the state
+ * change events and the order on air always agree.
+ *
+ * Admission control keeps a flood from queueing minutes of airtime:
+ *   - every client (IPv4 address or uid of a unix socket peer) has a
+ *     token bucket of commands, refilled at rate per second up to burst
+ *   - the airtime of all queued frames is limited to a global budget
+ *   - the queue itself is bounded
+ * A command over any limit is not queued, the client gets "busy" and the
+ * milliseconds after which a retry will pass. A frame for a plug that
+ * still waits in the queue is replaced in place by the newer command,
+ * only the last state asked for is sent.
+ *
+ * Every frame is rendered to its waveform when it is queued, its airtime
+ * is the sum of the pulses times the repeats. The transmit thread books
+ * the airtime sent in a sliding window; while the window is over the
+ * duty cycle budget, low priority frames (repeating the state a plug
+ * already has, or bulk) wait and high priority frames behind them go
+ * first.
+ *
+ * Frames queue in two lanes. Interactive frames go ahead of bulk ones
+ * (scenes, restoring all plugs), but after TX_BULK_STARVATION
+ * interactive frames in a row the oldest bulk frame gets its turn, so
+ * bulk frames are delayed, never starved.
+ *
+ * Plugs on one circuit can be switched on with a stagger: an on frame
+ * with one waits until its spacing after the last on frame of the same
+ * circuit group went on air, so the inrush currents don't add up. The
+ * queue does not idle meanwhile, offs and frames of other circuits
+ * behind it go first.
+ *
+ * A pairing sweep (rf433-sweep.cpp) is sent by the transmit thread as
+ * well, one frame at a time whenever no queued frame may go, so clients
+ * can still switch plugs while it runs. Sweep frames count against the
+ * duty cycle like low priority frames but never touch the state table.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "rf433-daemon.h"
+#include "rf433-tx.h"
+#include "rf433-events.h"
+#include "rf433-stats.h"
+#include "rf433-log.h"
+#include "rf433-trace.h"
+#include "rf433-journal.h"
+#include "rf433-history.h"
+#include "rf433-config.h"
+#include "rf433-sweep.h"
+#include "./rc-switch/RCSwitch.h"
+
+static RCSwitch mySwitch;
+static bool transmitterReady = false;
+static int transmitterPin = 0;
+
+struct TxLane {
+	TxFrame frames[TX_QUEUE_SIZE];
+	unsigned long head;
+	unsigned long tail;
+};
+
+static TxLane lanes[TX_LANES];
+// interactive frames sent in a row while bulk frames waited
+static int bulkPassed = 0;
+static pthread_mutex_t queueLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queueNotEmpty;	// on CLOCK_MONOTONIC, set up by txInit()
+// us of airtime queued, including the frame on air
+static long queuedAirtime = 0;
+
+struct TokenBucket {
+	unsigned long client;
+	double tokens;
+	long refilled;	// us
+};
+
+static TokenBucket buckets[TX_BUCKETS];
+static double bucketRate = 2;
+static double bucketBurst = 20;
+static long airtimeBudget = 10000000;
+
+// us on air per slot of the duty cycle window, only the transmit thread
+static long dutySlots[TX_DUTY_SLOTS];
+static long dutySlot = 0;	// absolute number of the newest slot
+static long dutySlotLength = 10000000;	// us
+static long dutyBudget = 0;	// us per window, 0 does not defer
+
+// monotonic us when the last on frame of each circuit went on air, only
+// the transmit thread
+static long circuitOnAt[TX_CIRCUITS];
+
+#define SWEEP_IDLE 0
+#define SWEEP_RUNNING 1
+#define SWEEP_PAUSED 2
+#define SWEEP_STOPPED 3
+#define SWEEP_DONE 4
+
+static const char* sweepStates[] = { "idle", "running", "paused", "stopped", "done" };
+
+// the one sweep, all under queueLock
+static SweepPlan sweep;
+static int sweepState = SWEEP_IDLE;
+static int sweepNext = 0;	// index of the next frame to send
+static int sweepSent = 0;
+static long sweepStarted = 0;	// monotonic us
+static long sweepOnAir = 0;	// us sent so far
+static unsigned long sweepGeneration = 0;	// counts the starts
+
+PI_THREAD(txThread);
+
+/**
+ * duty cycle budget in percent of the window, 0 only reports the
+ * utilization
+ */
+void txDutyCycle(double percent, long windowSeconds) {
+	if (windowSeconds <= 0) {
+		windowSeconds = 600;
+	}
+	dutySlotLength = windowSeconds * 1000000L / TX_DUTY_SLOTS;
+	dutyBudget = (long) (windowSeconds * 1e6 * percent / 100);
+}
+
+/**
+ * rate and burst in commands per client, 0 disables the rate limit
+ * budget in ms of queued airtime
+ */
+void txInit(double rate, double burst, long budgetMs) {
+	bucketRate = rate;
+	bucketBurst = burst;
+	airtimeBudget = budgetMs * 1000;
+	mySwitch = RCSwitch();
+	mySwitch.setPulseLength(300);
+	// deadlines come from statsNow(), a step of the wall clock when NTP
+	// syncs must not move them
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&queueNotEmpty, &attr);
+	pthread_condattr_destroy(&attr);
+	if (piThreadCreate(txThread) != 0) {
+		error("ERROR starting transmit thread");
+	}
+}
+
+/**
+ * set up wiringPi and the transmitter before the first frame, a daemon
+ * that is only asked for states never touches the GPIO
+ */
+static void transmitterSetup() {
+	const Config* config = configEnter();
+	int pin = config->pin;
+	configExit();
+	if (transmitterReady) {
+		// moved by a reload of the config
+		if (pin != transmitterPin) {
+			mySwitch.disableTransmit();
+			mySwitch.enableTransmit(pin);
+			transmitterPin = pin;
+			LOG_I("transmitter on pin %d", pin);
+		}
+		return;
+	}
+	if (wiringPiSetup() == -1) {
+		error("ERROR setting up wiringPi");
+	}
+	// high priority scheduling for exact pulses
+	piHiPri(20);
+	usleep(50000);
+	mySwitch.enableTransmit(pin);
+	transmitterPin = pin;
+	transmitterReady = true;
+	LOG_I("transmitter ready");
+}
+
+/**
+ * render the waveform of one repeat, returns the airtime of all repeats
+ * in us
+ */
+long txRender(TxFrame* frame) {
+	long pulses = protocolWave(frame->bits, frame->wave);
+	frame->airtime = (long) TX_REPEAT * pulses * frame->pulseLength;
+	return frame->airtime;
+}
+
+/**
+ * the frame of a parsed on or off command, rendered when it is queued
+ */
+void txBuild(TxFrame* frame, const Protocol* protocol, const CommandContext* ctx, bool on, int pulseLength) {
+	frame->type = protocol->txType;
+	frame->protocol = 1;
+	frame->pulseLength = pulseLength;
+	frame->on = on;
+	frame->bits = protocol->encode(ctx, on);
+	frame->number = ctx->switchNumber;
+	if (frame->type == TX_TRISTATE) {
+		triStateWord(frame->bits, frame->code);
+	}
+	else {
+		strcpy(frame->code, ctx->group);
+	}
+	frame->airtime = 0;
+}
+
+/**
+ * move the duty cycle window to now, returns the airtime in it
+ */
+static long dutyUsed(long now) {
+	long slot = now / dutySlotLength;
+	for (long i = dutySlot + 1; i <= slot && i <= dutySlot + TX_DUTY_SLOTS; i++) {
+		dutySlots[i % TX_DUTY_SLOTS] = 0;
+	}
+	dutySlot = slot;
+	long used = 0;
+	for (int i = 0; i < TX_DUTY_SLOTS; i++) {
+		used += dutySlots[i];
+	}
+	return used;
+}
+
+static inline TxFrame* laneFrame(TxLane* lane, unsigned long i) {
+	return &lane->frames[i & (TX_QUEUE_SIZE - 1)];
+}
+
+/**
+ * take a frame out of the middle of a lane, the ones in front move up
+ * queueLock is held
+ */
+static TxFrame laneRemove(TxLane* lane, unsigned long index) {
+	TxFrame frame = *laneFrame(lane, index);
+	for (unsigned long i = index; i > lane->head; i--) {
+		*laneFrame(lane, i) = *laneFrame(lane, i - 1);
+	}
+	lane->head++;
+	return frame;
+}
+
+static int queueDepth() {
+	int depth = 0;
+	for (int l = 0; l < TX_LANES; l++) {
+		depth += lanes[l].tail - lanes[l].head;
+	}
+	return depth;
+}
+
+/**
+ * take a token of the client, returns 0 or the ms until the next token
+ * queueLock is held
+ */
+static int takeToken(unsigned long client, long now) {
+	if (bucketRate <= 0 || client == 0) {
+		return 0;
+	}
+	TokenBucket* bucket = NULL;
+	TokenBucket* oldest = &buckets[0];
+	for (int i = 0; i < TX_BUCKETS; i++) {
+		if (buckets[i].client == client) {
+			bucket = &buckets[i];
+			break;
+		}
+		if (buckets[i].refilled < oldest->refilled) {
+			oldest = &buckets[i];
+		}
+	}
+	if (bucket == NULL) {
+		bucket = oldest;
+		bucket->client = client;
+		bucket->tokens = bucketBurst;
+		bucket->refilled = now;
+	}
+	bucket->tokens += (now - bucket->refilled) * bucketRate / 1e6;
+	if (bucket->tokens > bucketBurst) {
+		bucket->tokens = bucketBurst;
+	}
+	bucket->refilled = now;
+	if (bucket->tokens < 1) {
+		return (int) ((1 - bucket->tokens) * 1000 / bucketRate) + 1;
+	}
+	bucket->tokens -= 1;
+	return 0;
+}
+
+/**
+ * return the token of a frame that was not queued after all, a client
+ * told to retry has not used its rate
+ * queueLock is held since takeToken()
+ */
+static void giveToken(unsigned long client) {
+	if (bucketRate <= 0 || client == 0) {
+		return;
+	}
+	for (int i = 0; i < TX_BUCKETS; i++) {
+		if (buckets[i].client == client) {
+			buckets[i].tokens += 1;
+			if (buckets[i].tokens > bucketBurst) {
+				buckets[i].tokens = bucketBurst;
+			}
+			return;
+		}
+	}
+}
+
+/**
+ * queue a frame and store the new state of its plug
+ * returns 0 when queued, else the ms after which the client may retry
+ */
+int txSubmit(TxFrame* frame, int addr, int state, int source, unsigned long client) {
+	frame->addr = addr;
+	frame->source = source;
+	frame->deferred = false;
+	frame->staggered = false;
+	frame->queuedAt = statsNow();
+	// frames of named devices come rendered with the config
+	if (frame->airtime == 0) {
+		txRender(frame);
+	}
+	frame->trace = traceCurrent();
+	frame->traceId = frame->trace != NULL ? frame->trace->id : 0;
+	long now = frame->queuedAt;
+
+	pthread_mutex_lock(&queueLock);
+	// repeating a known state can wait, a change someone waits for not
+	bool repeat = stateIsKnown(addr) && stateGet(addr) == state;
+	frame->priority = source != EVENT_SOURCE_NETWORK || frame->lane == TX_LANE_BULK || repeat ? TX_PRIO_LOW : TX_PRIO_HIGH;
+	int retryAfter = takeToken(client, now);
+	if (retryAfter > 0) {
+		pthread_mutex_unlock(&queueLock);
+		statsCount(STAT_BUSY_RATE);
+		return retryAfter;
+	}
+	// a frame of the plug that is still waiting gets the new state
+	TxLane* lane = &lanes[frame->lane];
+	TxLane* waitingLane = NULL;
+	unsigned long waiting = 0;
+	for (int l = 0; l < TX_LANES; l++) {
+		for (unsigned long i = lanes[l].head; i < lanes[l].tail; i++) {
+			if (laneFrame(&lanes[l], i)->addr == addr) {
+				waitingLane = &lanes[l];
+				waiting = i;
+			}
+		}
+	}
+	if (waitingLane != lane && (lane->tail - lane->head == TX_QUEUE_SIZE
+			|| (waitingLane == NULL && queuedAirtime + frame->airtime > airtimeBudget))) {
+		// retry when enough of the queue went on air
+		long excess = queuedAirtime + frame->airtime - airtimeBudget;
+		retryAfter = (excess > 0 ? excess : frame->airtime) / 1000 + 1;
+		giveToken(client);
+		pthread_mutex_unlock(&queueLock);
+		statsCount(STAT_BUSY_AIRTIME);
+		return retryAfter;
+	}
+	// the queue lock is not held while the disk catches up
+	frame->journalSeq = journalAppend(JOURNAL_ACCEPTED, addr, state, source, frame->lane, frame->bits, false);
+	if (frame->journalSeq == JOURNAL_FULL) {
+		giveToken(client);
+		pthread_mutex_unlock(&queueLock);
+		statsCount(STAT_BUSY_JOURNAL);
+		return JOURNAL_WINDOW_US / 1000 + 1;
+	}
+	if (waitingLane == lane) {
+		queuedAirtime += frame->airtime - laneFrame(lane, waiting)->airtime;
+		*laneFrame(lane, waiting) = *frame;
+		statsCount(STAT_SUPERSEDED);
+	}
+	else {
+		if (waitingLane != NULL) {
+			// moves to the lane of the newer command
+			queuedAirtime -= laneRemove(waitingLane, waiting).airtime;
+			statsCount(STAT_SUPERSEDED);
+		}
+		*laneFrame(lane, lane->tail) = *frame;
+		lane->tail++;
+		queuedAirtime += frame->airtime;
+	}
+	traceEnqueue(frame->trace);
+	statsSetQueueDepth(queueDepth());
+	statsSetQueueAirtime(queuedAirtime / 1000);
+	int previous = stateSet(addr, state);
+	plugMeta[addr].pending.store(state, std::memory_order_relaxed);
+	if (previous != state) {
+		plugMeta[addr].changed.store(time(NULL), std::memory_order_relaxed);
+		plugMeta[addr].source.store(source, std::memory_order_relaxed);
+		historyRecord(addr, state);
+		// into the ring in the order of the changes, the wake up after
+		publishEvent(addr, state, source);
+	}
+	pthread_cond_signal(&queueNotEmpty);
+	pthread_mutex_unlock(&queueLock);
+	if (previous != state) {
+		eventsWake();
+	}
+	return 0;
+}
+
+static void transmit(TxFrame* frame) {
+	mySwitch.setProtocol(frame->protocol, frame->pulseLength);
+	switch (frame->type) {
+		case TX_ELRO:
+			if (frame->on) {
+				mySwitch.switchOn(frame->code, frame->number);
+			}
+			else {
+				mySwitch.switchOff(frame->code, frame->number);
+			}
+			break;
+		case TX_TRISTATE:
+			mySwitch.sendTriState(frame->code);
+			LOG_D("sent TriState signal: pSystemCode[%s]", frame->code);
+			break;
+		case TX_ZAP:
+			// off has always been sent with switchOnZap and on with switchOffZap
+			if (frame->on) {
+				mySwitch.switchOffZap(frame->code, frame->number);
+			}
+			else {
+				mySwitch.switchOnZap(frame->code, frame->number);
+			}
+			break;
+	}
+}
+
+/**
+ * may the frame go on air now or does the duty cycle hold it back
+ */
+static bool dutyAllows(TxFrame* frame, long used) {
+	// a window without airtime always takes one frame, however long
+	if (frame->priority == TX_PRIO_HIGH || dutyBudget == 0 || used == 0 || used + frame->airtime <= dutyBudget) {
+		return true;
+	}
+	if (!frame->deferred) {
+		frame->deferred = true;
+		statsCount(STAT_DEFERRED);
+	}
+	return false;
+}
+
+/**
+ * may the frame go on air now or must it keep its spacing after the last
+ * on frame of its circuit, then lowers ready to the time it may
+ */
+static bool staggerAllows(TxFrame* frame, long now, long* ready) {
+	if (!frame->on || frame->stagger == 0) {
+		return true;
+	}
+	long at = circuitOnAt[frame->circuit] + frame->stagger;
+	if (at <= now) {
+		return true;
+	}
+	if (at < *ready) {
+		*ready = at;
+	}
+	if (!frame->staggered) {
+		frame->staggered = true;
+		statsCount(STAT_STAGGERED);
+	}
+	return false;
+}
+
+/**
+ * next frame to send: the oldest interactive one, after
+ * TX_BULK_STARVATION of them in a row the oldest bulk one, and none while
+ * only frames the duty cycle or a stagger holds back wait
+ * returns the lane and stores the index, -1 for none, then ready is the
+ * earliest time a staggered frame may go
+ * queueLock is held
+ */
+static int pickFrame(long used, long now, unsigned long* index, long* ready) {
+	int first = bulkPassed >= TX_BULK_STARVATION ? TX_LANE_BULK : TX_LANE_INTERACTIVE;
+	for (int n = 0; n < TX_LANES; n++) {
+		int l = (first + n) % TX_LANES;
+		for (unsigned long i = lanes[l].head; i < lanes[l].tail; i++) {
+			TxFrame* frame = laneFrame(&lanes[l], i);
+			if (staggerAllows(frame, now, ready) && dutyAllows(frame, used)) {
+				*index = i;
+				return l;
+			}
+		}
+	}
+	return -1;
+}
+
+/**
+ * send the next frame of a running sweep, while no queued frame may go,
+ * returns whether there was one
+ * queueLock is held, it is released while the frame is on air
+ */
+static bool sweepStep(long used) {
+	if (sweepState != SWEEP_RUNNING || sweepNext >= sweep.count) {
+		return false;
+	}
+	long airtime = sweepFrameAirtime(&sweep, sweepNext);
+	if (dutyBudget > 0 && used > 0 && used + airtime > dutyBudget) {
+		return false;
+	}
+	// the plan may be replaced by a new sweep meanwhile
+	unsigned short wave[PROTOCOL_WAVE_PULSES];
+	memcpy(wave, sweep.wave + sweepNext * PROTOCOL_WAVE_PULSES, sizeof(wave));
+	int repeat = sweep.repeat;
+	int gap = sweep.gap;
+	unsigned long generation = sweepGeneration;
+	sweepNext++;
+	pthread_mutex_unlock(&queueLock);
+
+	transmitterSetup();
+	sweepSend(wave, repeat, gap, transmitterPin);
+
+	pthread_mutex_lock(&queueLock);
+	dutyUsed(statsNow());
+	dutySlots[dutySlot % TX_DUTY_SLOTS] += airtime;
+	if (generation == sweepGeneration) {
+		sweepSent++;
+		sweepOnAir += airtime;
+		if (sweepSent == sweep.count && sweepState != SWEEP_STOPPED) {
+			sweepState = SWEEP_DONE;
+			LOG_I("sweep done, %d frames", sweepSent);
+		}
+	}
+	return true;
+}
+
+/**
+ * progress of the sweep, queueLock is held
+ */
+static int sweepStatus(char* out, int size) {
+	if (sweepState == SWEEP_IDLE) {
+		return snprintf(out, size, "sweep idle\n");
+	}
+	// last is on air or was the last one
+	char last[20] = "-";
+	char next[20] = "-";
+	if (sweepNext > 0) {
+		protocolKey(sweep.addrs[sweepNext - 1], last);
+	}
+	if (sweepNext < sweep.count) {
+		protocolKey(sweep.addrs[sweepNext], next);
+	}
+	return snprintf(out, size, "sweep %s %s %s sent=%d of=%d last=%s next=%s elapsed_ms=%ld left_ms=%ld\n",
+		sweepStates[sweepState], sweep.protocol->name, sweep.on ? "on" : "off", sweepSent, sweep.count,
+		last, next, (statsNow() - sweepStarted) / 1000, (sweep.airtime - sweepOnAir) / 1000);
+}
+
+/**
+ * answer of "sweep start SPEC [off] [repeat=N] [gap=US] [pulse=US]",
+ * "sweep pause", "sweep resume", "sweep stop" and "sweep" for the
+ * progress
+ */
+int txSweep(const char* args, char* out, int size) {
+	char copy[256];
+	char* words[8];
+	int n = 0;
+	snprintf(copy, sizeof(copy), "%s", args);
+	for (char* word = strtok(copy, " \t\r\n"); word != NULL && n < 8; word = strtok(NULL, " \t\r\n")) {
+		words[n++] = word;
+	}
+	SweepPlan plan;
+	bool start = n >= 2 && strcmp(words[0], "start") == 0;
+	if (start) {
+		bool on = true;
+		int repeat = SWEEP_REPEAT;
+		int gap = 0;
+		int pulse = 0;
+		for (int i = 2; i < n; i++) {
+			if (strcmp(words[i], "off") == 0) on = false;
+			else if (strncmp(words[i], "repeat=", 7) == 0) repeat = atoi(words[i] + 7);
+			else if (strncmp(words[i], "gap=", 4) == 0) gap = atoi(words[i] + 4);
+			else if (strncmp(words[i], "pulse=", 6) == 0) pulse = atoi(words[i] + 6);
+			else if (strcmp(words[i], "on") != 0) return snprintf(out, size, "E unknown option %s\n", words[i]);
+		}
+		// rendered before the lock, pulse lengths as the config has them
+		const Config* config = configEnter();
+		const char* failed = sweepPlan(&plan, words[1], on, repeat, gap, pulse, config->pulse);
+		configExit();
+		if (failed != NULL) {
+			sweepFree(&plan);
+			return snprintf(out, size, "E %s\n", failed);
+		}
+		LOG_I("sweep of %s, %d frames, %ld ms", words[1], plan.count, plan.airtime / 1000);
+	}
+	else if (n > 1 || (n == 1 && strcmp(words[0], "pause") != 0 && strcmp(words[0], "resume") != 0
+			&& strcmp(words[0], "stop") != 0 && strcmp(words[0], "status") != 0)) {
+		return snprintf(out, size, "E usage: sweep [start SPEC [off] [repeat=N] [gap=US] [pulse=US]|pause|resume|stop]\n");
+	}
+
+	pthread_mutex_lock(&queueLock);
+	SweepPlan old = sweep;
+	if (start) {
+		sweep = plan;
+		// an empty range is done at once
+		sweepState = plan.count > 0 ? SWEEP_RUNNING : SWEEP_DONE;
+		sweepNext = 0;
+		sweepSent = 0;
+		sweepOnAir = 0;
+		sweepStarted = statsNow();
+		sweepGeneration++;
+	}
+	else if (n == 1 && strcmp(words[0], "pause") == 0 && sweepState == SWEEP_RUNNING) {
+		sweepState = SWEEP_PAUSED;
+	}
+	else if (n == 1 && strcmp(words[0], "resume") == 0 && sweepState == SWEEP_PAUSED) {
+		sweepState = SWEEP_RUNNING;
+	}
+	else if (n == 1 && strcmp(words[0], "stop") == 0 && (sweepState == SWEEP_RUNNING || sweepState == SWEEP_PAUSED)) {
+		sweepState = SWEEP_STOPPED;
+	}
+	int len = sweepStatus(out, size);
+	pthread_cond_signal(&queueNotEmpty);
+	pthread_mutex_unlock(&queueLock);
+	if (start) {
+		sweepFree(&old);
+	}
+	return len;
+}
+
+static void waitUntil(long at) {
+	long wait = at - statsNow();
+	if (wait < 0) {
+		wait = 0;
+	}
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ts.tv_sec += wait / 1000000;
+	ts.tv_nsec += (wait % 1000000) * 1000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+	pthread_cond_timedwait(&queueNotEmpty, &queueLock, &ts);
+}
+
+PI_THREAD(txThread) {
+	TxFrame frame;
+	long window = dutySlotLength * TX_DUTY_SLOTS;
+	while (true) {
+		pthread_mutex_lock(&queueLock);
+		unsigned long next;
+		int lane;
+		while (true) {
+			long now = statsNow();
+			long used = dutyUsed(now);
+			statsSetDutyCycle(used * 1000 / window);
+			// wakes up when a slot leaves the window, for the utilization too
+			long ready = (dutySlot + 1) * dutySlotLength;
+			lane = pickFrame(used, now, &next, &ready);
+			if (lane >= 0) {
+				break;
+			}
+			if (sweepStep(used)) {
+				continue;
+			}
+			waitUntil(ready);
+		}
+		frame = laneRemove(&lanes[lane], next);
+		plugMeta[frame.addr].pending.store(STATE_PENDING_NONE, std::memory_order_relaxed);
+		if (lane == TX_LANE_BULK || lanes[TX_LANE_BULK].head == lanes[TX_LANE_BULK].tail) {
+			bulkPassed = 0;
+		}
+		else {
+			bulkPassed++;
+		}
+		statsSetQueueDepth(queueDepth());
+		pthread_mutex_unlock(&queueLock);
+
+		long start = statsNow();
+		statsRecord(HIST_QUEUE_WAIT, start - frame.queuedAt);
+		statsRecord(lane == TX_LANE_BULK ? HIST_QUEUE_WAIT_BULK : HIST_QUEUE_WAIT_INTERACTIVE, start - frame.queuedAt);
+		if (frame.trace != NULL && frame.trace->id != frame.traceId) {
+			frame.trace = NULL;
+		}
+		transmitterSetup();
+		journalWait(frame.journalSeq);
+		traceTxBegin(frame.trace);
+		start = statsNow();
+		if (frame.on) {
+			circuitOnAt[frame.circuit] = start;
+		}
+		transmit(&frame);
+		long onAir = statsNow() - start;
+		statsRecord(HIST_ON_AIR, onAir);
+		statsRecord(HIST_ON_AIR_ERROR, onAir > frame.airtime ? onAir - frame.airtime : frame.airtime - onAir);
+		// the ring may have wrapped while on air under a flood
+		if (frame.trace != NULL && frame.trace->id == frame.traceId) {
+			traceTxEnd(frame.trace);
+		}
+		journalAppend(JOURNAL_SENT, frame.addr, frame.on, frame.source, lane, frame.bits);
+
+		pthread_mutex_lock(&queueLock);
+		dutyUsed(statsNow());
+		dutySlots[dutySlot % TX_DUTY_SLOTS] += frame.airtime;
+		queuedAirtime -= frame.airtime;
+		statsSetQueueAirtime(queuedAirtime / 1000);
+		pthread_mutex_unlock(&queueLock);
+	}
+	return 0;
+}
@@ -0,0 +1,69 @@
+/**
+ * transmit thread of the RCSwitch daemon
+ */
+
+#define TX_ELRO 0
+#define TX_TRISTATE 1
+#define TX_ZAP 2
+
+// power of two, per lane, commands are refused with "busy" while it is full
+#define TX_QUEUE_SIZE 256
+// clients tracked by the rate limiter, the least recently seen is reused
+#define TX_BUCKETS 64
+// rc-switch sends every frame this often
+#define TX_REPEAT 10
+// high and low times of one repeat, see protocolWave()
+#define TX_WAVE_PULSES PROTOCOL_WAVE_PULSES
+// slots of the duty cycle window, it moves on one slot at a time
+#define TX_DUTY_SLOTS 60
+
+// low priority frames wait while the duty cycle budget is used up
+#define TX_PRIO_LOW 0
+#define TX_PRIO_HIGH 1
+
+#define TX_LANE_INTERACTIVE 0
+#define TX_LANE_BULK 1
+#define TX_LANES 2
+// interactive frames sent in a row before a waiting bulk frame goes
+#define TX_BULK_STARVATION 4
+// circuit groups of the stagger policy, 0 is every plug without one
+#define TX_CIRCUITS 32
+
+struct TraceRecord;
+struct Protocol;
+struct CommandContext;
+
+/**
+ * everything the transmitter needs for one command, the workers fill
+ * it in, only the transmit thread touches RCSwitch and the GPIO
+ */
+struct TxFrame {
+	int type;
+	int protocol;
+	int pulseLength;
+	char code[16];	// group of Elro and Zap, code word of tri-state frames
+	int number;	// switch number of Elro and Zap
+	bool on;
+	unsigned long bits;	// 24 bit code word on air, see rf433-protocol.h
+	int addr;
+	int source;
+	int lane;	// set by the caller
+	int priority;
+	bool deferred;	// counted once when it had to wait for the duty cycle
+	int circuit;	// group of plugs on one circuit, see TX_CIRCUITS
+	long stagger;	// us from the last on frame of the circuit before this one if on, 0 for none
+	bool staggered;	// counted once when it had to wait for the stagger
+	unsigned char wave[TX_WAVE_PULSES];	// in pulse lengths, high first
+	long airtime;	// us of all repeats, from the rendered waveform, 0 until rendered
+	long queuedAt;	// monotonic us
+	TraceRecord* trace;
+	unsigned long traceId;	// the trace slot may be reused meanwhile
+	unsigned long journalSeq;	// on disk before the frame goes on air
+};
+
+void txInit(double rate, double burst, long budgetMs);
+void txDutyCycle(double percent, long windowSeconds);
+long txRender(TxFrame* frame);
+void txBuild(TxFrame* frame, const Protocol* protocol, const CommandContext* ctx, bool on, int pulseLength);
+int txSubmit(TxFrame* frame, int addr, int state, int source, unsigned long client);
+int txSweep(const char* args, char* out, int size);
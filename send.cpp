@@ -4,10 +4,20 @@
  */
 
 #include "./rc-switch/RCSwitch.h"
+#include "rf433-protocol.h"
+#include "rf433-sweep.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <string>
+#include <vector>
 #include <getopt.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 //#include <iostream>
 
 void printUsage() {
@@ -27,15 +37,44 @@ void printUsage() {
     printf("   Switches the instance to decimal mode.\n");
     printf("   The <system code> is the decimal value to send");
     printf("   The <unit code> is the required pulse length");
-    printf("   The <command> option specifies the protocol (e.g. 1)");
+    printf("   The <command> option specifies the protocol (e.g. 1)\n\n");
+    printf(" --daemon[=HOST:PORT|SOCKET]:\n");
+    printf("   Hands the commands to a running rf433-daemon instead of driving the\n");
+    printf("   pin, so both never transmit at the same time and the daemon knows\n");
+    printf("   the state of every socket. Needs no root and no GPIO setup.\n");
+    printf("   A value containing a / is a unix socket. Default: 127.0.0.1:11337\n");
+    printf("   Only the classic mode is supported, -b, -d, -i and -r are not.\n\n");
+    printf(" --bulk:\n");
+    printf("   With --daemon, queues the commands in the bulk lane of the daemon, so\n");
+    printf("   a scene or restoring many sockets doesn't delay interactive clicks.\n\n");
+    printf(" -f FILE, --file=FILE:\n");
+    printf("   Reads commands from FILE, one per line in the same form as on the\n");
+    printf("   command line: <systemCode> <unitCode> [...] <command>. Use - for stdin.\n");
+    printf("   wiringPi and the transmitter are set up once for all of them, lines\n");
+    printf("   starting with # are ignored.\n\n");
     printf(" -h, --help:\n");
     printf("   displays this help\n\n");
+    printf(" -i, --interleave:\n");
+    printf("   Sends the frames of all commands round robin, one repeat per round,\n");
+    printf("   instead of all repeats of one command before the next. Every plug gets\n");
+    printf("   its first frame early, the total air time stays the same.\n\n");
     printf(" -p X, --pin=X\n");
     printf("   Sets the pin to use to communicate with the sender.\n");
     printf("   Important note: when running as root, pin numbers are wiringPi numbers while\n");
     printf("   in user mode (-u, --user) pin numbers are BCM_GPIO numbers.\n");
     printf("   See http://wiringpi.com/pins/ for details.\n");
     printf("   Default: 0 in normal mode, 17 in user mode\n\n");
+    printf(" -r N, --repeat=N\n");
+    printf("   Number of times each frame is sent. Default: 10\n\n");
+    printf(" --sweep=SYSTEM|KEY[-KEY] [command]:\n");
+    printf("   Pairing sweep: sends the frame of every address of a system, e.g. 1\n");
+    printf("   for all 1024 Elro addresses, or of a range of daemon keys like\n");
+    printf("   10000001-10000131, on unless the command is 0. The frames are\n");
+    printf("   rendered up front and sent back to back, 2 repeats each unless -r is\n");
+    printf("   given. Ctrl-Z pauses after the frame on air and fg resumes, Ctrl-C\n");
+    printf("   stops and prints where to continue. Works with --daemon as well.\n\n");
+    printf(" --gap=US:\n");
+    printf("   With --sweep, microseconds of silence after every frame. Default: 0\n\n");
     printf(" -s, --silent:\n");
     printf("   Don't print any text, except for errors\n\n");
     printf(" -u, --user:\n");
@@ -47,33 +86,432 @@ void printUsage() {
     printf("   http://wiringpi.com/pins/.\n\n");
 }
 
-int main(int argc, char *argv[]) {
-    bool silentMode = false;
-    bool binaryMode = false;
-    bool decimalMode = false;
-    bool userMode = false;
-    int pin = 0;
-    int controlArgCount = 0;
+bool silentMode = false;
+bool binaryMode = false;
+bool decimalMode = false;
+
+/**
+ * send one command: <systemCode> <unitCode> [<systemCode> <unitCode>...] <command>
+ */
+int sendCommand(RCSwitch &mySwitch, int controlArgCount, char *controlArgs[]) {
     char *systemCode;
     char *unitCode;
     int command;
     bool multiMode;
 
+    multiMode = controlArgCount > 3;
+
+    int numberOfActuators = (controlArgCount - 1) / 2;
+    // check if there are enough arguments supplied, we need (numberOfActuators * 2) + 1
+
+    if (controlArgCount < 3 || controlArgCount != (numberOfActuators * 2) + 1) {
+      printf("invalid set of control arguments\nuse <systemCode> <unitCode> <command> or\n");
+      printf("<systemCode> <unitCode> [<systemCode> <unitCode>...] <command>\n");
+      return 1;
+    }
+
+    if (multiMode && !silentMode) {
+        printf("multi mode\n");
+    }
+
+    command = atoi(controlArgs[controlArgCount - 1]);
+    for (int i = 0; i < numberOfActuators; i++) {
+        int indexSystemCode = i * 2;
+        int indexUnitCode = indexSystemCode + 1;
+        systemCode = controlArgs[indexSystemCode];
+        unitCode = controlArgs[indexUnitCode];
+
+        if (binaryMode) {
+        	if (!silentMode) {
+            	printf("sending in binary mode systemCode[%s] unitCode[%s] command[%i]\n", systemCode, unitCode, command);
+       	 }
+            switch (command) {
+                case 1:
+/**
+ * Change back to original library "rc-switch" with 
+ *   void switchOn(const char* sGroup, const char* sDevice); 
+ *
+ * @param sGroup        Code of the switch group (refers to DIP switches 1..5 where "1" = on and "0" = off, if all DIP switches are on it's "11111")
+ * @param sDevice       Code of the switch device (refers to DIP switches 6..10 (A..E) where "1" = on and "0" = off, if all DIP switches are on it's "11111")
+ */
+                    mySwitch.switchOn(systemCode, unitCode);
+                    break;
+                case 0:
+                    mySwitch.switchOff(systemCode, unitCode);
+                    break;
+                default:
+                    printf("command[%i] is unsupported\n", command);
+                    printUsage();
+                    if (!multiMode) {
+                        return -1;
+                    }
+            }
+        } else if (decimalMode) {
+                    printf("sending in deciamal[%i] Pulse[%i] Protocol[%i]\n", atoi(systemCode), atoi(unitCode), command);
+			mySwitch.setProtocol(command,atoi(unitCode));
+			mySwitch.send (atoi(systemCode),24);
+	    } else {
+		if (!silentMode) {
+                    printf("sending in classic mode systemCode[%s] unitCode[%s] command[%i]\n", systemCode, unitCode, command);
+             }
+
+            switch (command) {
+                case 1:
+                    mySwitch.switchOn(systemCode, atoi(unitCode));
+                    break;
+                case 0:
+                    mySwitch.switchOff(systemCode, atoi(unitCode));
+                    break;
+                case 2:
+                    // 00001 2 on binary coded
+                    mySwitch.send("010101010001000101010001");
+                    break;
+                case 3:
+                    // 00001 2 on as TriState
+                    mySwitch.sendTriState("FFFF0F0FFF0F");
+                    break;
+                default:
+                    printf("command[%i] is unsupported\n", command);
+                    printUsage();
+                    if (!multiMode) {
+                        return -1;
+                    }
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * split a command line of a batch into its arguments, in place
+ */
+int splitLine(char *line, char *controlArgs[], int maxArgs) {
+    int count = 0;
+    for (char *token = strtok(line, " \t\r\n"); token != NULL && count < maxArgs; token = strtok(NULL, " \t\r\n")) {
+        controlArgs[count++] = token;
+    }
+    return count;
+}
+
+/**
+ * translate one command into the daemon protocol, one line per socket
+ * "00001 1 00001 2 1" -> "100001161\n", "100001081\n"
+ * returns the number of lines, 0 if the command is not supported
+ */
+int daemonCommand(int controlArgCount, char *controlArgs[], std::vector<std::string> &out) {
+    int numberOfActuators = (controlArgCount - 1) / 2;
+    if (controlArgCount < 3 || controlArgCount != (numberOfActuators * 2) + 1) {
+        printf("invalid set of control arguments\n");
+        return 0;
+    }
+    int command = atoi(controlArgs[controlArgCount - 1]);
+    if (command != 0 && command != 1) {
+        printf("command[%i] is unsupported in daemon mode\n", command);
+        return 0;
+    }
+    size_t before = out.size();
+    for (int i = 0; i < numberOfActuators; i++) {
+        const char *systemCode = controlArgs[i * 2];
+        int unitCode = atoi(controlArgs[i * 2 + 1]);
+        if (strlen(systemCode) != 5 || strspn(systemCode, "01") != 5 || unitCode < 1 || unitCode > 5) {
+            printf("systemCode[%s] unitCode[%s] is out of range\n", systemCode, controlArgs[i * 2 + 1]);
+            out.resize(before);
+            return 0;
+        }
+        // the daemon numbers the units as the DIP switches, A = 16 ... E = 1
+        char line[16];
+        snprintf(line, sizeof(line), "1%s%02d%d\n", systemCode, ElroEncoder::unitSwitch(unitCode), command);
+        out.push_back(line);
+    }
+    return numberOfActuators;
+}
+
+int connectDaemon(const char *target) {
+    int fd;
+    if (strchr(target, '/') != NULL) {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, target, sizeof(addr.sun_path) - 1);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0) {
+            return fd;
+        }
+    } else {
+        char host[64];
+        strncpy(host, target, sizeof(host) - 1);
+        host[sizeof(host) - 1] = '\0';
+        int port = 11337;
+        char *colon = strrchr(host, ':');
+        if (colon != NULL) {
+            *colon = '\0';
+            port = atoi(colon + 1);
+        }
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        if (inet_pton(AF_INET, host[0] ? host : "127.0.0.1", &addr.sin_addr) != 1) {
+            printf("invalid daemon address %s\n", target);
+            return -1;
+        }
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0) {
+            return fd;
+        }
+    }
+    perror(target);
+    if (fd >= 0) {
+        close(fd);
+    }
+    return -1;
+}
+
+bool writeAll(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+/**
+ * send all commands over one pipelined connection, a window of lines is
+ * written before the replies are read so neither side blocks the other
+ */
+int sendDaemon(const char *target, std::vector<std::string> &batch, bool bulk) {
+    std::vector<std::string> commands;
+    int result = 0;
+    for (size_t n = 0; n < batch.size(); n++) {
+        char line[1024];
+        char *controlArgs[64];
+        strncpy(line, batch[n].c_str(), sizeof(line) - 1);
+        line[sizeof(line) - 1] = '\0';
+        if (daemonCommand(splitLine(line, controlArgs, 64), controlArgs, commands) == 0) {
+            if (batch.size() == 1) {
+                return 1;
+            }
+            printf("line %zu failed: %s", n + 1, batch[n].c_str());
+            result = 1;
+        }
+    }
+    if (commands.empty()) {
+        return result;
+    }
+
+    int fd = connectDaemon(target);
+    if (fd < 0) {
+        return 1;
+    }
+    const int window = 64;
+    size_t sent = 0;
+    size_t answered = 0;
+    std::string reply;
+    char buffer[4096];
+    bool ok = bulk ? writeAll(fd, "pipeline bulk\n", 14) : writeAll(fd, "pipeline\n", 9);
+    while (ok && answered < commands.size()) {
+        // keep up to window commands in flight
+        std::string chunk;
+        while (sent < commands.size() && sent - answered < window) {
+            chunk += commands[sent++];
+        }
+        if (!chunk.empty() && !writeAll(fd, chunk.data(), chunk.size())) {
+            ok = false;
+            break;
+        }
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n <= 0) {
+            ok = false;
+            break;
+        }
+        reply.append(buffer, n);
+        size_t eol;
+        while ((eol = reply.find('\n')) != std::string::npos) {
+            std::string answer = reply.substr(0, eol);
+            reply.erase(0, eol + 1);
+            answered++;
+            if (answer[0] == 'E') {
+                printf("daemon: %s for %s", answer.c_str(), commands[answered - 1].c_str());
+                result = 1;
+            } else if (!silentMode) {
+                printf("%s\n", answer.c_str());
+            }
+        }
+    }
+    if (!ok) {
+        printf("lost the daemon after %zu of %zu replies\n", answered, commands.size());
+        result = 1;
+    }
+    close(fd);
+    return result;
+}
+
+/*
+ * pairing sweep, see rf433-sweep.h
+ */
+volatile sig_atomic_t sweepSignal = 0;
+
+void onSweepSignal(int sig) {
+    sweepSignal = sig;
+}
+
+/**
+ * stop the process until fg, the handler is back afterwards
+ */
+void sweepSuspend() {
+    sweepSignal = 0;
+    signal(SIGTSTP, SIG_DFL);
+    raise(SIGTSTP);
+    signal(SIGTSTP, onSweepSignal);
+}
+
+/**
+ * one message to the daemon on a connection of its own, the reply in out
+ */
+bool queryDaemon(const char *target, const char *message, char *out, size_t size) {
+    int fd = connectDaemon(target);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = writeAll(fd, message, strlen(message));
+    size_t len = 0;
+    ssize_t n;
+    while (ok && len < size - 1 && (n = read(fd, out + len, size - 1 - len)) > 0) {
+        len += n;
+    }
+    out[len] = '\0';
+    close(fd);
+    return ok && len > 0;
+}
+
+/**
+ * send the frames of a sweep on the pin, one after the other
+ */
+int sweepLocal(int pin, const char *spec, bool on, int repeat, int gap) {
+    SweepPlan plan;
+    const char *failed = sweepPlan(&plan, spec, on, repeat, gap, 0, NULL);
+    if (failed != NULL) {
+        printf("sweep %s: %s\n", spec, failed);
+        sweepFree(&plan);
+        return 1;
+    }
+    if (!silentMode) {
+        printf("sweeping %d addresses of %s, %.1f s on air\n", plan.count, plan.protocol->name, plan.airtime / 1e6);
+    }
+    signal(SIGINT, onSweepSignal);
+    signal(SIGTSTP, onSweepSignal);
+    long left = plan.airtime;
+    char key[20];
+    int i;
+    for (i = 0; i < plan.count && sweepSignal != SIGINT; i++) {
+        if (sweepSignal == SIGTSTP) {
+            protocolKey(plan.addrs[i], key);
+            printf("\npaused before %s, fg resumes\n", key);
+            sweepSuspend();
+        }
+        protocolKey(plan.addrs[i], key);
+        sweepSend(plan.wave + i * PROTOCOL_WAVE_PULSES, plan.repeat, plan.gap, pin);
+        left -= sweepFrameAirtime(&plan, i);
+        if (!silentMode) {
+            printf("\rsweep %d/%d %s, %.1f s left ", i + 1, plan.count, key, left / 1e6);
+            fflush(stdout);
+        }
+    }
+    if (!silentMode) {
+        printf("\n");
+    }
+    int result = 0;
+    if (i < plan.count) {
+        char last[20];
+        protocolKey(plan.addrs[i], key);
+        protocolKey(plan.addrs[plan.count - 1], last);
+        printf("stopped, continue with --sweep=%s-%s\n", key, last);
+        result = 1;
+    }
+    sweepFree(&plan);
+    return result;
+}
+
+/**
+ * start the sweep in the daemon and follow its progress, Ctrl-Z and
+ * Ctrl-C pause and stop it there
+ */
+int sweepDaemon(const char *target, const char *spec, bool on, int repeat, int gap) {
+    char message[256];
+    char reply[512];
+    snprintf(message, sizeof(message), "sweep start %s %s repeat=%d gap=%d\n", spec, on ? "on" : "off", repeat, gap);
+    if (!queryDaemon(target, message, reply, sizeof(reply))) {
+        printf("no reply from the daemon\n");
+        return 1;
+    }
+    signal(SIGINT, onSweepSignal);
+    signal(SIGTSTP, onSweepSignal);
+    while (strncmp(reply, "sweep running", 13) == 0 || strncmp(reply, "sweep paused", 12) == 0) {
+        if (!silentMode) {
+            reply[strcspn(reply, "\n")] = '\0';
+            printf("\r%s ", reply);
+            fflush(stdout);
+        }
+        const char *next = "sweep\n";
+        if (sweepSignal == SIGTSTP) {
+            queryDaemon(target, "sweep pause\n", reply, sizeof(reply));
+            printf("\npaused, fg resumes\n");
+            sweepSuspend();
+            next = "sweep resume\n";
+        } else if (sweepSignal == SIGINT) {
+            next = "sweep stop\n";
+        } else {
+            usleep(250000);
+        }
+        if (!queryDaemon(target, next, reply, sizeof(reply))) {
+            printf("\nlost the daemon\n");
+            return 1;
+        }
+    }
+    if (!silentMode || reply[0] == 'E') {
+        printf("%s%s", silentMode ? "" : "\n", reply);
+    }
+    return strncmp(reply, "sweep done", 10) == 0 ? 0 : 1;
+}
+
+int main(int argc, char *argv[]) {
+    bool userMode = false;
+    bool interleave = false;
+    int pin = 0;
+    int repeat = 0;
+    const char *commandFile = NULL;
+    const char *daemonTarget = NULL;
+    const char *sweepSpec = NULL;
+    int gap = 0;
+    bool bulk = false;
+    int controlArgCount = 0;
+
     int c;
     while (1) {
         static struct option long_options[] =
             {
               {"binary", no_argument, 0, 'b'},
+              {"bulk", no_argument, 0, 'B'},
               {"decimal", no_argument, 0, 'd'}, // new decimal mode
+              {"daemon", optional_argument, 0, 'D'},
+              {"file", required_argument, 0, 'f'},
+              {"gap", required_argument, 0, 'G'},
               {"help", no_argument, 0, 'h'},
+              {"interleave", no_argument, 0, 'i'},
               {"pin", required_argument, 0, 'p'},
+              {"repeat", required_argument, 0, 'r'},
               {"silent", no_argument, 0, 's'},
+              {"sweep", required_argument, 0, 'S'},
               {"user", no_argument, 0, 'u'},
               0
             };
         int option_index = 0;
 
-        c = getopt_long (argc, argv, "bdhp:su",long_options, &option_index);
+        c = getopt_long (argc, argv, "bdf:hip:r:su",long_options, &option_index);
         /* Detect the end of the options. */
         if (c == -1)
             break;
@@ -82,15 +520,36 @@ int main(int argc, char *argv[]) {
             case 'b':
                 binaryMode = true;
                 break;
+            case 'B':
+                bulk = true;
+                break;
             case 'd':
                 decimalMode = true;
                 break;
+            case 'D':
+                daemonTarget = optarg != NULL ? optarg : "127.0.0.1:11337";
+                break;
+            case 'f':
+                commandFile = optarg;
+                break;
+            case 'G':
+                gap = atoi(optarg);
+                break;
+            case 'i':
+                interleave = true;
+                break;
             case 'p':
                 pin = atoi(optarg);
                 break;
+            case 'r':
+                repeat = atoi(optarg);
+                break;
             case 's':
                 silentMode = true;
                 break;
+            case 'S':
+                sweepSpec = optarg;
+                break;
             case 'u':
                 userMode = true;
                 break;
@@ -111,119 +570,122 @@ int main(int argc, char *argv[]) {
       pin = 17;
     }
 
+    /*
+     * collect the commands, either from the command line or one per line
+     * of the command file
+     */
+    std::vector<std::string> batch;
     controlArgCount = argc - optind;
-    // we need at least 3 args: systemCode, unitCode and command
-    if (controlArgCount >= 3) {
-        if (!silentMode) {
-            if (binaryMode) {
-                printf("operating in binary mode\n");
-            }
-            if (userMode) {
-                printf("operating in user mode\n");
+    if (commandFile != NULL) {
+        FILE *in = strcmp(commandFile, "-") == 0 ? stdin : fopen(commandFile, "r");
+        if (in == NULL) {
+            perror(commandFile);
+            return 1;
+        }
+        char line[1024];
+        while (fgets(line, sizeof(line), in) != NULL) {
+            size_t start = strspn(line, " \t\r\n");
+            if (line[start] != '\0' && line[start] != '#') {
+                batch.push_back(line + start);
             }
-            printf("using pin %d\n", pin);
         }
+        if (in != stdin) {
+            fclose(in);
+        }
+    } else if (controlArgCount >= 3) {
+        // we need at least 3 args: systemCode, unitCode and command
+        std::string line;
+        for (int i = optind; i < argc; i++) {
+            line += argv[i];
+            line += ' ';
+        }
+        batch.push_back(line);
+    }
+    // a sweep takes at most the command, 0 or 1
+    bool sweepOn = optind >= argc || atoi(argv[optind]) != 0;
+    if (sweepSpec != NULL) {
+        protocolInit();
+        batch.clear();
+    } else if (batch.empty()) {
+        printUsage();
+        return -1;
+    }
 
-        char *controlArgs[controlArgCount];
-        int i = 0;
-        while (optind < argc && i < controlArgCount) {
-            controlArgs[i] = argv[optind++];
-            i++;
+    /*
+     * the daemon owns the transmitter, don't touch the pin
+     */
+    if (daemonTarget != NULL) {
+        if (sweepSpec != NULL) {
+            return sweepDaemon(daemonTarget, sweepSpec, sweepOn, repeat > 0 ? repeat : SWEEP_REPEAT, gap);
         }
+        if (binaryMode || decimalMode || interleave || repeat > 0) {
+            printf("-b, -d, -i and -r are not supported with --daemon\n");
+            return 1;
+        }
+        return sendDaemon(daemonTarget, batch, bulk);
+    }
 
-        multiMode = controlArgCount > 3;
+    if (!silentMode) {
+        if (binaryMode) {
+            printf("operating in binary mode\n");
+        }
+        if (userMode) {
+            printf("operating in user mode\n");
+        }
+        printf("using pin %d\n", pin);
+    }
 
-        int numberOfActuators = (controlArgCount - 1) / 2;
-        // check if there are enough arguments supplied, we need (numberOfActuators * 2) + 1
+    /*
+     * set up once for all commands
+     */
+    if (userMode) {
+        if (wiringPiSetupSys() == -1) return 1;
+    } else {
+        if (wiringPiSetup() == -1) return 1;
+    }
+    piHiPri(20);
+    RCSwitch mySwitch = RCSwitch();
+    mySwitch.setPulseLength(300);
+    mySwitch.enableTransmit(pin);
 
-        if (controlArgCount != (numberOfActuators * 2) + 1) {
-          printf("invalid set of control arguments\nuse <systemCode> <unitCode> <command> or\n");
-          printf("<systemCode> <unitCode> [<systemCode> <unitCode>...] <command>\n");
-          return 1;
-        }
+    if (sweepSpec != NULL) {
+        return sweepLocal(pin, sweepSpec, sweepOn, repeat > 0 ? repeat : SWEEP_REPEAT, gap);
+    }
 
-        if (multiMode && !silentMode) {
-            printf("multi mode\n");
-        }
+    int rounds = 1;
+    if (interleave) {
+        rounds = repeat > 0 ? repeat : 10;
+        mySwitch.setRepeatTransmit(1);
+    } else if (repeat > 0) {
+        mySwitch.setRepeatTransmit(repeat);
+    }
 
-        command = atoi(controlArgs[controlArgCount - 1]);
-        if (userMode) {
-            if (wiringPiSetupSys() == -1) return 1;
-        } else {
-            if (wiringPiSetup() == -1) return 1;
-        }
-        piHiPri(20);
-        RCSwitch mySwitch = RCSwitch();
-        mySwitch.setPulseLength(300);
-        mySwitch.enableTransmit(pin);
-
-        for (i = 0; i < numberOfActuators; i++) {
-            int indexSystemCode = i * 2;
-            int indexUnitCode = indexSystemCode + 1;
-            systemCode = controlArgs[indexSystemCode];
-            unitCode = controlArgs[indexUnitCode];
-
-            if (binaryMode) {
-            	if (!silentMode) {
-                	printf("sending in binary mode systemCode[%s] unitCode[%s] command[%i]\n", systemCode, unitCode, command);
-           	 }
-                switch (command) {
-                    case 1:
-/**
- * Change back to original library "rc-switch" with 
- *   void switchOn(const char* sGroup, const char* sDevice); 
- *
- * @param sGroup        Code of the switch group (refers to DIP switches 1..5 where "1" = on and "0" = off, if all DIP switches are on it's "11111")
- * @param sDevice       Code of the switch device (refers to DIP switches 6..10 (A..E) where "1" = on and "0" = off, if all DIP switches are on it's "11111")
- */
-                        mySwitch.switchOn(systemCode, unitCode);
-                        break;
-                    case 0:
-                        mySwitch.switchOff(systemCode, unitCode);
-                        break;
-                    default:
-                        printf("command[%i] is unsupported\n", command);
-                        printUsage();
-                        if (!multiMode) {
-                            return -1;
-                        }
-                }
-            } else if (decimalMode) {
-                        printf("sending in deciamal[%i] Pulse[%i] Protocol[%i]\n", atoi(systemCode), atoi(unitCode), command);
-			mySwitch.setProtocol(command,atoi(unitCode));
-			mySwitch.send (atoi(systemCode),24);
-	    } else {
-		if (!silentMode) {
-                        printf("sending in classic mode systemCode[%s] unitCode[%s] command[%i]\n", systemCode, unitCode, command);
-                 }
-
-                switch (command) {
-                    case 1:
-                        mySwitch.switchOn(systemCode, atoi(unitCode));
-                        break;
-                    case 0:
-                        mySwitch.switchOff(systemCode, atoi(unitCode));
-                        break;
-                    case 2:
-                        // 00001 2 on binary coded
-                        mySwitch.send("010101010001000101010001");
-                        break;
-                    case 3:
-                        // 00001 2 on as TriState
-                        mySwitch.sendTriState("FFFF0F0FFF0F");
-                        break;
-                    default:
-                        printf("command[%i] is unsupported\n", command);
-                        printUsage();
-                        if (!multiMode) {
-                            return -1;
-                        }
+    int result = 0;
+    bool quiet = silentMode;
+    std::vector<bool> failed(batch.size(), false);
+    for (int round = 0; round < rounds; round++) {
+        for (size_t n = 0; n < batch.size(); n++) {
+            if (failed[n]) {
+                continue;
+            }
+            char line[1024];
+            char *controlArgs[64];
+            strncpy(line, batch[n].c_str(), sizeof(line) - 1);
+            line[sizeof(line) - 1] = '\0';
+            int count = splitLine(line, controlArgs, 64);
+            int status = sendCommand(mySwitch, count, controlArgs);
+            if (status != 0) {
+                if (batch.size() == 1) {
+                    return status;
                 }
+                printf("line %zu failed: %s", n + 1, batch[n].c_str());
+                failed[n] = true;
+                result = 1;
             }
         }
-        return 0;
-    } else {
-        printUsage();
-        return -1;
+        // the later rounds repeat the same frames
+        silentMode = true;
     }
+    silentMode = quiet;
+    return result;
 }
@@ -14,6 +14,14 @@ $source = $_SERVER['SERVER_ADDR'];
 $target = '127.0.0.1';
 $port = 11337;
 
+/*
+ * unix domain socket of the daemon (rf433-daemon -s PATH)
+ * if set, it is used instead of ip address and port, which
+ * saves the TCP round trip for every plug on the page
+ * the webserver user needs write permission on the socket
+ */
+$socket_path = '';
+
 /*
  * specify configuration of sockets to use
  *   array("systemcode", "group" , "plug", "description");
@@ -13,6 +13,23 @@
  */
 include("config.php");
 
+/*
+ * open a connection to the daemon, via unix socket if configured
+ */
+function daemon_connect() {
+  global $source, $target, $port, $socket_path;
+  if ($socket_path != "") {
+    $socket = socket_create(AF_UNIX, SOCK_STREAM, 0) or die("Could not create socket\n");
+    socket_connect($socket, $socket_path) or die("Could not connect to socket\n");
+  }
+  else {
+    $socket = socket_create(AF_INET, SOCK_STREAM, SOL_TCP) or die("Could not create socket\n");
+    socket_bind($socket, $source) or die("Could not bind to socket\n");
+    socket_connect($socket, $target, $port) or die("Could not connect to socket\n");
+  }
+  return $socket;
+}
+
 /*
  * get parameters
  */
@@ -35,9 +52,7 @@ else $nDelay=0;
  */
 $output = $nSys.$nGroup.$nSwitch.$nAction.$nDelay;
 if (strlen($output) >= 5) {
-  $socket = socket_create(AF_INET, SOCK_STREAM, SOL_TCP) or die("Could not create socket\n");
-  socket_bind($socket, $source) or die("Could not bind to socket\n");
-  socket_connect($socket, $target, $port) or die("Could not connect to socket\n");
+  $socket = daemon_connect();
   socket_write($socket, $output, strlen ($output)) or die("Could not write output\n");
   socket_close($socket);
   header("Location: index.php?delay=$nDelay");
@@ -96,9 +111,7 @@ foreach($config as $current) {
 
     if ($index%2 == 0) echo "<TR>\n";
 
-    $socket = socket_create(AF_INET, SOCK_STREAM, SOL_TCP) or die("Could not create socket\n");
-    socket_bind($socket, $source) or die("Could not bind to socket\n");
-    socket_connect($socket, $target, $port) or die("Could not connect to socket\n");
+    $socket = daemon_connect();
 
     $output = $iSys.$ig.$is."2";
     socket_write($socket, $output, strlen ($output)) or die("Could not write output\n");